@@ -0,0 +1,63 @@
+#include "devices/ioapic.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* The I/O APIC routes device interrupts to local APICs.  See
+   [IOAPIC] for details.
+
+   We keep delivering ISA interrupts through the 8259 PICs to the
+   bootstrap processor's LINT0 ("virtual wire" mode), so all we
+   do here is make sure the I/O APIC does not deliver them a
+   second time. */
+
+/* Physical address of the I/O APIC on PCs and under QEMU. */
+#define IOAPIC_BASE 0xfec00000
+
+/* Register select and data window, as byte offsets. */
+#define IOREGSEL 0x00
+#define IOWIN 0x10
+
+/* Registers. */
+#define IOAPIC_VER 0x01         /* Version and max redirection entry. */
+#define IOAPIC_REDTBL 0x10      /* Redirection table, 2 registers each. */
+
+#define REDIR_MASKED 0x10000    /* Interrupt masked. */
+
+static volatile uint32_t *ioapic;
+
+static void
+ioapic_write (int reg, uint32_t value) {
+	ioapic[IOREGSEL / 4] = reg;
+	ioapic[IOWIN / 4] = value;
+}
+
+static uint32_t
+ioapic_read (int reg) {
+	ioapic[IOREGSEL / 4] = reg;
+	return ioapic[IOWIN / 4];
+}
+
+/* Maps the I/O APIC and masks every redirection entry. */
+void
+ioapic_init (void) {
+	uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) ptov (IOAPIC_BASE), 1);
+	int i, max_entry;
+
+	if (pte == NULL)
+		PANIC ("cannot map I/O APIC");
+	*pte = IOAPIC_BASE | PTE_P | PTE_W | PTE_PCD | PTE_PWT;
+	invlpg ((uint64_t) ptov (IOAPIC_BASE));
+	ioapic = ptov (IOAPIC_BASE);
+
+	max_entry = (ioapic_read (IOAPIC_VER) >> 16) & 0xff;
+	for (i = 0; i <= max_entry; i++) {
+		ioapic_write (IOAPIC_REDTBL + 2 * i, REDIR_MASKED | (0x20 + i));
+		ioapic_write (IOAPIC_REDTBL + 2 * i + 1, 0);
+	}
+	printf ("I/O APIC: %d redirection entries masked.\n", max_entry + 1);
+}
@@ -0,0 +1,267 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* The code in this file drives the local APIC that every x86
+   core has.  See [IA32-v3a] chapter 10 "Advanced Programmable
+   Interrupt Controller (APIC)". */
+
+/* IA32_APIC_BASE model-specific register. */
+#define MSR_APIC_BASE 0x1b
+#define APIC_BASE_ENABLE (1 << 11)      /* APIC global enable. */
+#define APIC_BASE_ADDR_MASK 0xfffff000
+
+/* Register offsets, in bytes. */
+#define LAPIC_ID 0x020          /* ID. */
+#define LAPIC_TPR 0x080         /* Task Priority. */
+#define LAPIC_EOI 0x0b0         /* End Of Interrupt. */
+#define LAPIC_SVR 0x0f0         /* Spurious Interrupt Vector. */
+#define LAPIC_ESR 0x280         /* Error Status. */
+#define LAPIC_ICRLO 0x300       /* Interrupt Command, bits 0:31. */
+#define LAPIC_ICRHI 0x310       /* Interrupt Command, bits 32:63. */
+#define LAPIC_TIMER 0x320       /* LVT Timer. */
+#define LAPIC_LINT0 0x350       /* LVT Local Interrupt 0. */
+#define LAPIC_LINT1 0x360       /* LVT Local Interrupt 1. */
+#define LAPIC_ERROR 0x370       /* LVT Error. */
+#define LAPIC_TICR 0x380        /* Timer Initial Count. */
+#define LAPIC_TCCR 0x390        /* Timer Current Count. */
+#define LAPIC_TDCR 0x3e0        /* Timer Divide Configuration. */
+
+/* Register bits. */
+#define SVR_ENABLE 0x100        /* APIC software enable. */
+#define LVT_MASKED 0x10000      /* Interrupt masked. */
+#define LVT_NMI 0x400           /* Deliver as NMI. */
+#define LVT_EXTINT 0x700        /* Deliver as ExtINT (8259 virtual wire). */
+#define TIMER_PERIODIC 0x20000  /* Periodic timer mode. */
+#define TDCR_DIV16 0x3          /* Divide timer clock by 16. */
+#define ICR_INIT 0x500          /* INIT IPI. */
+#define ICR_STARTUP 0x600       /* Start-up IPI. */
+#define ICR_DELIVS 0x1000       /* Delivery pending. */
+#define ICR_ASSERT 0x4000       /* Level assert. */
+#define ICR_LEVEL 0x8000        /* Level triggered. */
+
+/* Kernel virtual address of the local APIC's registers. */
+static volatile uint32_t *lapic;
+
+/* Local APIC timer counts per timer tick.
+   Initialized by lapic_timer_calibrate(). */
+static uint32_t lapic_counts_per_tick;
+
+static void lapic_write (int reg, uint32_t value);
+static uint32_t lapic_read (int reg);
+static bool lapic_wait_icr (void);
+static void lapic_map (uint64_t paddr);
+static intr_handler_func lapic_timer_interrupt;
+static intr_handler_func lapic_resched_interrupt;
+static intr_handler_func lapic_tlb_interrupt;
+static intr_handler_func lapic_spurious_interrupt;
+
+/* Returns true if the CPU has a local APIC. */
+bool
+lapic_present (void) {
+	uint32_t eax = 1, ebx, ecx, edx;
+
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	return (edx & (1 << 9)) != 0;
+}
+
+/* Enables the running CPU's local APIC.  The first call, made on
+   the bootstrap processor (BSP is true), also maps the register
+   page and registers the APIC's interrupt handlers.  The BSP
+   keeps receiving 8259 interrupts on LINT0 ("virtual wire"
+   mode); application processors mask it. */
+void
+lapic_init (bool bsp) {
+	uint64_t base = read_msr (MSR_APIC_BASE);
+
+	if (bsp) {
+		ASSERT (lapic == NULL);
+		lapic_map (base & APIC_BASE_ADDR_MASK);
+		intr_register_ext (LAPIC_TIMER_VEC, lapic_timer_interrupt,
+				"LAPIC Timer");
+		intr_register_ext (LAPIC_RESCHED_VEC, lapic_resched_interrupt,
+				"LAPIC Reschedule IPI");
+		intr_register_ext (LAPIC_TLB_VEC, lapic_tlb_interrupt,
+				"LAPIC TLB Shootdown IPI");
+		intr_register_int (LAPIC_SPURIOUS_VEC, 0, INTR_OFF,
+				lapic_spurious_interrupt, "LAPIC Spurious");
+	}
+	ASSERT (lapic != NULL);
+	write_msr (MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+
+	lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+	lapic_write (LAPIC_TIMER, LVT_MASKED | LAPIC_TIMER_VEC);
+	lapic_write (LAPIC_LINT0, bsp ? LVT_EXTINT : LVT_MASKED);
+	lapic_write (LAPIC_LINT1, bsp ? LVT_NMI : LVT_MASKED);
+	lapic_write (LAPIC_ERROR, LVT_MASKED);
+
+	/* Clear any pending error and interrupt, then accept all
+	   priorities. */
+	lapic_write (LAPIC_ESR, 0);
+	lapic_write (LAPIC_ESR, 0);
+	lapic_write (LAPIC_EOI, 0);
+	lapic_write (LAPIC_TPR, 0);
+}
+
+/* Returns the running CPU's local APIC ID. */
+uint8_t
+lapic_id (void) {
+	return lapic_read (LAPIC_ID) >> 24;
+}
+
+/* Acknowledges the interrupt being serviced. */
+void
+lapic_eoi (void) {
+	lapic_write (LAPIC_EOI, 0);
+}
+
+/* Sends interrupt VEC to the CPU whose local APIC ID is APIC_ID. */
+void
+lapic_send_ipi (uint8_t apic_id, uint8_t vec) {
+	enum intr_level old_level = intr_disable ();
+
+	lapic_write (LAPIC_ICRHI, (uint32_t) apic_id << 24);
+	lapic_write (LAPIC_ICRLO, vec);
+	lapic_wait_icr ();
+	intr_set_level (old_level);
+}
+
+/* Starts the application processor APIC_ID running real-mode
+   code at physical address TRAMPOLINE, which must be page
+   aligned and below 1 MB, with the INIT-SIPI-SIPI sequence of
+   [MP] appendix B.4.  Returns false if an IPI was not
+   delivered. */
+bool
+lapic_start_ap (uint8_t apic_id, uint64_t trampoline) {
+	int i;
+
+	ASSERT (trampoline % PGSIZE == 0 && trampoline < 0x100000);
+	ASSERT (intr_get_level () == INTR_ON);
+
+	lapic_write (LAPIC_ICRHI, (uint32_t) apic_id << 24);
+	lapic_write (LAPIC_ICRLO, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+	if (!lapic_wait_icr ())
+		return false;
+	timer_usleep (200);
+	lapic_write (LAPIC_ICRLO, ICR_INIT | ICR_LEVEL);
+	if (!lapic_wait_icr ())
+		return false;
+	timer_msleep (10);
+
+	for (i = 0; i < 2; i++) {
+		lapic_write (LAPIC_ICRHI, (uint32_t) apic_id << 24);
+		lapic_write (LAPIC_ICRLO, ICR_STARTUP | (trampoline >> 12));
+		if (!lapic_wait_icr ())
+			return false;
+		timer_usleep (200);
+	}
+	return true;
+}
+
+/* Measures how many local APIC timer counts make up one 8254
+   timer tick.  Must be called on the BSP with interrupts on,
+   after timer_calibrate(). */
+void
+lapic_timer_calibrate (void) {
+	const int calibration_ticks = 10;
+	int64_t start;
+
+	ASSERT (intr_get_level () == INTR_ON);
+
+	/* Start counting on a tick boundary. */
+	start = timer_ticks ();
+	while (timer_ticks () == start)
+		barrier ();
+
+	lapic_write (LAPIC_TDCR, TDCR_DIV16);
+	lapic_write (LAPIC_TICR, UINT32_MAX);
+	timer_sleep (calibration_ticks);
+	lapic_counts_per_tick =
+		(UINT32_MAX - lapic_read (LAPIC_TCCR)) / calibration_ticks;
+	lapic_write (LAPIC_TICR, 0);
+
+	printf ("Local APIC timer: %'"PRIu32" counts/tick.\n",
+			lapic_counts_per_tick);
+}
+
+/* Starts the running CPU's local APIC timer interrupting
+   TIMER_FREQ times per second. */
+void
+lapic_timer_start (void) {
+	ASSERT (lapic_counts_per_tick != 0);
+
+	lapic_write (LAPIC_TDCR, TDCR_DIV16);
+	lapic_write (LAPIC_TIMER, TIMER_PERIODIC | LAPIC_TIMER_VEC);
+	lapic_write (LAPIC_TICR, lapic_counts_per_tick);
+}
+
+static void
+lapic_write (int reg, uint32_t value) {
+	lapic[reg / 4] = value;
+	(void) lapic[LAPIC_ID / 4]; /* Wait for the write to finish. */
+}
+
+static uint32_t
+lapic_read (int reg) {
+	return lapic[reg / 4];
+}
+
+/* Waits for the last interprocessor interrupt to be accepted.
+   Returns false if it never is. */
+static bool
+lapic_wait_icr (void) {
+	int timeout;
+
+	for (timeout = 100000; timeout > 0; timeout--)
+		if ((lapic_read (LAPIC_ICRLO) & ICR_DELIVS) == 0)
+			return true;
+	return false;
+}
+
+/* Maps the register page at physical address PADDR into the
+   kernel's address space with caching disabled.  The mapping
+   is made in base_pml4's kernel half, which every user page
+   table shares. */
+static void
+lapic_map (uint64_t paddr) {
+	uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) ptov (paddr), 1);
+
+	if (pte == NULL)
+		PANIC ("cannot map local APIC");
+	*pte = paddr | PTE_P | PTE_W | PTE_PCD | PTE_PWT;
+	invlpg ((uint64_t) ptov (paddr));
+	lapic = ptov (paddr);
+}
+
+/* Local APIC timer interrupt handler for application
+   processors.  The BSP's clock is still the 8254. */
+static void
+lapic_timer_interrupt (struct intr_frame *args UNUSED) {
+	thread_tick ();
+}
+
+/* Another CPU put a thread on our run queue that may outrank
+   the running one. */
+static void
+lapic_resched_interrupt (struct intr_frame *args UNUSED) {
+	thread_preempt ();
+}
+
+/* Another CPU changed PTEs of the address space we are running. */
+static void
+lapic_tlb_interrupt (struct intr_frame *args UNUSED) {
+	tlb_shootdown_interrupt ();
+}
+
+/* Spurious interrupts need no EOI. */
+static void
+lapic_spurious_interrupt (struct intr_frame *args UNUSED) {
+}
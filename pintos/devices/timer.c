@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/spinlock.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 
@@ -20,6 +21,26 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Hierarchical timer wheel holding armed timer events.
+   Level 0 has one slot per tick; each slot of level N covers
+   64^N ticks.  An event is placed in the lowest level whose
+   range covers its distance from WHEEL_NEXT and is moved
+   ("cascaded") down a level when its slot comes around, so
+   arming is O(1) and a tick with nothing due only looks at a
+   single empty list. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Next tick whose level 0 slot has not been run yet. */
+static int64_t wheel_next;
+
+/* Protects the wheel and every armed event's ARMED and ELEM.
+   Callbacks run without it held, so they may arm events. */
+static struct spinlock wheel_lock;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -28,6 +49,8 @@ static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void wheel_insert (struct timer_event *);
+static bool wheel_run (int64_t now);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
@@ -37,6 +60,13 @@ timer_init (void) {
 	/* 8254 input frequency divided by TIMER_FREQ, rounded to
 	   nearest. */
 	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+	int level, slot;
+
+	for (level = 0; level < WHEEL_LEVELS; level++)
+		for (slot = 0; slot < WHEEL_SIZE; slot++)
+			list_init (&wheel[level][slot]);
+	wheel_next = 1;
+	spinlock_init (&wheel_lock, "timer wheel");
 
 	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
 	outb (0x40, count & 0xff);
@@ -97,9 +127,7 @@ timer_sleep (int64_t ticks) {
 	if (timer_elapsed(start) >= ticks)
 		return;
 
-	int64_t sleep_until = ticks + start;
-
-	thread_sleep (sleep_until);
+	thread_sleep (start + ticks);
 }
 
 /* Suspends execution for approximately MS milliseconds. */
@@ -126,12 +154,145 @@ timer_print_stats (void) {
 	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Initializes timer event EV to call FUNC with AUX when it
+   fires.  The event is not armed. */
+void
+timer_event_init (struct timer_event *ev, timer_event_func *func, void *aux) {
+	ASSERT (ev != NULL);
+	ASSERT (func != NULL);
+
+	ev->expires = 0;
+	ev->func = func;
+	ev->aux = aux;
+	ev->armed = false;
+}
+
+/* Arms EV to fire at timer tick EXPIRES, re-arming it if it is
+   already pending.  If EXPIRES has already passed, EV fires on
+   the next timer tick.
+
+   This function may be called from an interrupt handler, including
+   from another event's callback. */
+void
+timer_event_arm (struct timer_event *ev, int64_t expires) {
+	enum intr_level old_level;
+
+	ASSERT (ev != NULL);
+
+	old_level = intr_disable ();
+	spin_lock (&wheel_lock);
+	if (ev->armed)
+		list_remove (&ev->elem);
+	ev->expires = expires;
+	ev->armed = true;
+	wheel_insert (ev);
+	spin_unlock (&wheel_lock);
+	intr_set_level (old_level);
+}
+
+/* Disarms EV.  Returns true if EV was pending, false if it had
+   already fired or was never armed.  With more than one CPU, a
+   false return does not mean EV's callback has finished running
+   on the CPU that fired it. */
+bool
+timer_event_cancel (struct timer_event *ev) {
+	enum intr_level old_level;
+	bool was_armed;
+
+	ASSERT (ev != NULL);
+
+	old_level = intr_disable ();
+	spin_lock (&wheel_lock);
+	was_armed = ev->armed;
+	if (was_armed) {
+		list_remove (&ev->elem);
+		ev->armed = false;
+	}
+	spin_unlock (&wheel_lock);
+	intr_set_level (old_level);
+
+	return was_armed;
+}
+
+/* Puts EV into the wheel slot matching its distance from
+   WHEEL_NEXT.  Events beyond the reach of the top level are
+   parked in its farthest slot and re-sorted when it cascades. */
+static void
+wheel_insert (struct timer_event *ev) {
+	int64_t expires = ev->expires < wheel_next ? wheel_next : ev->expires;
+	int64_t delta = expires - wheel_next;
+	int level;
+
+	ASSERT (spin_holding (&wheel_lock));
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+			break;
+	if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+		expires = wheel_next + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+	list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK],
+			&ev->elem);
+}
+
+/* Re-inserts every event in slot SLOT of LEVEL, which moves
+   each of them to a lower level.  Returns SLOT. */
+static int
+wheel_cascade (int level, int slot) {
+	struct list *list = &wheel[level][slot];
+
+	while (!list_empty (list))
+		wheel_insert (list_entry (list_pop_front (list),
+					struct timer_event, elem));
+	return slot;
+}
+
+/* Fires every event due at or before tick NOW.  Returns true if
+   any callback was run. */
+static bool
+wheel_run (int64_t now) {
+	bool fired = false;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	spin_lock (&wheel_lock);
+	while (wheel_next <= now) {
+		int slot = wheel_next & WHEEL_MASK;
+		struct list *list = &wheel[0][slot];
+		int level;
+
+		/* Level 0 wrapped around: pull the next stretch of
+		   events down from the upper levels. */
+		for (level = 1; slot == 0 && level < WHEEL_LEVELS; level++)
+			slot = wheel_cascade (level,
+					(wheel_next >> (WHEEL_BITS * level)) & WHEEL_MASK);
+
+		wheel_next++;
+		while (!list_empty (list)) {
+			struct timer_event *ev = list_entry (list_pop_front (list),
+					struct timer_event, elem);
+			timer_event_func *func = ev->func;
+			void *aux = ev->aux;
+
+			/* EV may be freed once its callback has started. */
+			ev->armed = false;
+			spin_unlock (&wheel_lock);
+			func (aux);
+			spin_lock (&wheel_lock);
+			fired = true;
+		}
+	}
+	spin_unlock (&wheel_lock);
+	return fired;
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED) {
 	ticks++;
 	thread_tick ();
-	thread_wake (ticks);
+	if (wheel_run (ticks))
+		thread_preempt ();
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
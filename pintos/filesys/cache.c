@@ -0,0 +1,385 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache for file system sectors.
+ *
+ * Every sector of the file system disk is read and written
+ * through this cache.  Entries are replaced with the clock
+ * algorithm, and dirty entries are written back when they are
+ * evicted, when they have been dirty for CACHE_DIRTY_EXPIRE ticks,
+ * or at shutdown.  A daemon thread reads sectors ahead of
+ * sequential readers. */
+
+/* Number of cached sectors. */
+#define CACHE_SIZE 64
+
+/* The write-behind daemon wakes up every CACHE_FLUSH_INTERVAL
+ * ticks and writes back sectors that have been dirty for at least
+ * CACHE_DIRTY_EXPIRE ticks. */
+#define CACHE_FLUSH_INTERVAL (5 * TIMER_FREQ)
+#define CACHE_DIRTY_EXPIRE (30 * TIMER_FREQ)
+
+/* Maximum number of pending read-ahead requests. */
+#define CACHE_RA_MAX 16
+
+/* A cached sector.
+ *
+ * SECTOR, IN_USE, FLUSHING, FLUSH_SECTOR, PIN_CNT and ACCESSED are
+ * protected by cache_lock.  DATA, VALID, DIRTY and DIRTY_SINCE are
+ * protected by LOCK, which is held across the disk I/O that fills
+ * or writes back the entry.  A pinned entry is never evicted, so
+ * its SECTOR does not change while a thread holds a pin. */
+struct cache_entry {
+	disk_sector_t sector;       /* Sector held, or being loaded. */
+	bool in_use;                /* False if SECTOR is meaningless. */
+	bool flushing;              /* Writing FLUSH_SECTOR back on eviction? */
+	disk_sector_t flush_sector; /* Evicted sector being written back. */
+	int pin_cnt;                /* Threads using or waiting for it. */
+	bool accessed;              /* Used since the clock hand passed? */
+
+	struct lock lock;           /* Held during disk I/O and copies. */
+	bool valid;                 /* DATA holds SECTOR's contents? */
+	bool dirty;                 /* DATA newer than the disk? */
+	int64_t dirty_since;        /* Tick at which DATA became dirty. */
+	uint8_t data[DISK_SECTOR_SIZE];
+};
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct mutex cache_lock;
+static size_t clock_hand;
+
+/* Pending read-ahead requests, a ring protected by cache_lock. */
+static disk_sector_t ra_queue[CACHE_RA_MAX];
+static size_t ra_head, ra_cnt;
+static struct semaphore ra_sema;
+
+/* Statistics, protected by cache_lock. */
+static long long hit_cnt;       /* Accesses found in the cache. */
+static long long miss_cnt;      /* Accesses that had to load. */
+static long long readahead_cnt; /* Sectors read ahead. */
+static long long writeback_cnt; /* Dirty sectors written back. */
+
+static struct cache_entry *cache_lookup (disk_sector_t);
+static struct cache_entry *cache_get (disk_sector_t, bool read,
+		bool readahead);
+static void cache_put (struct cache_entry *, bool dirty);
+static void cache_write_back (int64_t age);
+static void cache_readahead_daemon (void *aux);
+static void cache_writebehind_daemon (void *aux);
+
+/* Initializes the buffer cache and starts its daemons. */
+void
+cache_init (void) {
+	size_t i;
+
+	mutex_init (&cache_lock);
+	for (i = 0; i < CACHE_SIZE; i++) {
+		cache[i].in_use = false;
+		cache[i].flushing = false;
+		cache[i].pin_cnt = 0;
+		lock_init (&cache[i].lock);
+		cache[i].valid = false;
+		cache[i].dirty = false;
+	}
+	clock_hand = 0;
+	ra_head = ra_cnt = 0;
+	sema_init (&ra_sema, 0);
+
+	thread_create ("cache_ra", PRI_DEFAULT, cache_readahead_daemon, NULL);
+	thread_create ("cache_wb", PRI_DEFAULT, cache_writebehind_daemon, NULL);
+}
+
+/* Writes every dirty sector back to disk. */
+void
+cache_flush (void) {
+	cache_write_back (0);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) {
+	printf ("Buffer cache: %lld hits, %lld misses, %lld read-aheads, "
+			"%lld write-backs\n",
+			hit_cnt, miss_cnt, readahead_cnt, writeback_cnt);
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+ * DISK_SECTOR_SIZE bytes. */
+void
+cache_read (disk_sector_t sector, void *buffer) {
+	cache_read_at (sector, buffer, 0, DISK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS within sector SECTOR into
+ * BUFFER. */
+void
+cache_read_at (disk_sector_t sector, void *buffer, size_t ofs, size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, true, false);
+	memcpy (buffer, e->data + ofs, size);
+	cache_put (e, false);
+}
+
+/* Writes DISK_SECTOR_SIZE bytes from BUFFER to sector SECTOR. */
+void
+cache_write (disk_sector_t sector, const void *buffer) {
+	cache_write_at (sector, buffer, 0, DISK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER at byte OFS within sector SECTOR.
+ * A write that covers the whole sector does not read it first. */
+void
+cache_write_at (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, ofs != 0 || size != DISK_SECTOR_SIZE, false);
+	memcpy (e->data + ofs, buffer, size);
+	cache_put (e, true);
+}
+
+/* Asks the read-ahead daemon to bring SECTOR into the cache, unless
+ * it is cached already or too many requests are pending.  Does not
+ * wait for the read. */
+void
+cache_readahead (disk_sector_t sector) {
+	bool queued = false;
+
+	mutex_acquire (&cache_lock);
+	if (cache_lookup (sector) == NULL && ra_cnt < CACHE_RA_MAX) {
+		ra_queue[(ra_head + ra_cnt) % CACHE_RA_MAX] = sector;
+		ra_cnt++;
+		queued = true;
+	}
+	mutex_release (&cache_lock);
+
+	if (queued)
+		sema_up (&ra_sema);
+}
+
+/* Returns true if SECTOR is cached and its data has been read in,
+ * so that reading it would not wait for the disk.  The answer may
+ * be out of date by the time the caller acts on it. */
+bool
+cache_contains (disk_sector_t sector) {
+	struct cache_entry *e;
+	bool cached;
+
+	mutex_acquire (&cache_lock);
+	e = cache_lookup (sector);
+	cached = e != NULL && e->in_use && e->sector == sector && e->valid;
+	mutex_release (&cache_lock);
+	return cached;
+}
+
+/* Returns the entry that holds SECTOR or is writing it back, or a
+ * null pointer if there is none.  cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (disk_sector_t sector) {
+	struct cache_entry *e;
+
+	for (e = cache; e < cache + CACHE_SIZE; e++)
+		if ((e->in_use && e->sector == sector)
+				|| (e->flushing && e->flush_sector == sector))
+			return e;
+	return NULL;
+}
+
+/* Chooses an unpinned entry to replace with the clock algorithm.
+ * Returns a null pointer if every entry is pinned.  cache_lock
+ * must be held. */
+static struct cache_entry *
+cache_evict (void) {
+	size_t i;
+
+	for (i = 0; i < 2 * CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[clock_hand];
+
+		clock_hand = (clock_hand + 1) % CACHE_SIZE;
+		if (e->pin_cnt > 0)
+			continue;
+		if (e->in_use && e->accessed) {
+			e->accessed = false;
+			continue;
+		}
+		return e;
+	}
+	return NULL;
+}
+
+/* Drops a pin on E.  E's lock must not be held. */
+static void
+cache_unpin (struct cache_entry *e) {
+	mutex_acquire (&cache_lock);
+	e->pin_cnt--;
+	mutex_release (&cache_lock);
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held.
+ * Release it with cache_put().
+ *
+ * On a miss, evicts an entry, writing it back first if it is
+ * dirty, then reads SECTOR from disk unless READ is false because
+ * the caller will overwrite the whole sector.  Accesses on behalf
+ * of the read-ahead daemon (READAHEAD) do not count as hits or
+ * misses. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool read, bool readahead) {
+	for (;;) {
+		struct cache_entry *e;
+		disk_sector_t old_sector;
+		bool writeback;
+
+		mutex_acquire (&cache_lock);
+		e = cache_lookup (sector);
+		if (e != NULL) {
+			e->pin_cnt++;
+			e->accessed = true;
+			if (!readahead)
+				hit_cnt++;
+			mutex_release (&cache_lock);
+
+			/* Waits for any load or write-back in progress. */
+			lock_acquire (&e->lock);
+			if (e->sector == sector)
+				return e;
+
+			/* It was being evicted from SECTOR.  Now that the
+			 * write-back has finished, look again. */
+			lock_release (&e->lock);
+			mutex_acquire (&cache_lock);
+			e->pin_cnt--;
+			if (!readahead)
+				hit_cnt--;
+			mutex_release (&cache_lock);
+			continue;
+		}
+
+		e = cache_evict ();
+		if (e == NULL) {
+			mutex_release (&cache_lock);
+			thread_yield ();
+			continue;
+		}
+
+		/* An unpinned entry's lock is free. */
+		e->pin_cnt++;
+		e->accessed = true;
+		lock_acquire (&e->lock);
+
+		/* Until the write-back is done, lookups of the old sector
+		 * find this entry and wait on its lock instead of reading
+		 * stale data from disk. */
+		writeback = e->in_use && e->dirty;
+		old_sector = e->sector;
+		e->flushing = writeback;
+		e->flush_sector = old_sector;
+		e->in_use = true;
+		e->sector = sector;
+		e->valid = false;
+		if (readahead)
+			readahead_cnt++;
+		else
+			miss_cnt++;
+		if (writeback)
+			writeback_cnt++;
+		mutex_release (&cache_lock);
+
+		if (writeback) {
+			disk_write (filesys_disk, old_sector, e->data);
+			e->dirty = false;
+			mutex_acquire (&cache_lock);
+			e->flushing = false;
+			mutex_release (&cache_lock);
+		}
+		if (read)
+			disk_read (filesys_disk, sector, e->data);
+		e->valid = true;
+		return e;
+	}
+}
+
+/* Releases E, obtained from cache_get().  DIRTY says whether the
+ * caller modified its data. */
+static void
+cache_put (struct cache_entry *e, bool dirty) {
+	if (dirty && !e->dirty) {
+		e->dirty = true;
+		e->dirty_since = timer_ticks ();
+	}
+	lock_release (&e->lock);
+	cache_unpin (e);
+}
+
+/* Writes back every sector that has been dirty for at least AGE
+ * ticks. */
+static void
+cache_write_back (int64_t age) {
+	size_t i;
+
+	for (i = 0; i < CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+		disk_sector_t sector;
+		bool written = false;
+
+		mutex_acquire (&cache_lock);
+		if (!e->in_use) {
+			mutex_release (&cache_lock);
+			continue;
+		}
+		e->pin_cnt++;
+		sector = e->sector;
+		mutex_release (&cache_lock);
+
+		lock_acquire (&e->lock);
+		if (e->dirty && timer_elapsed (e->dirty_since) >= age) {
+			disk_write (filesys_disk, sector, e->data);
+			e->dirty = false;
+			written = true;
+		}
+		lock_release (&e->lock);
+
+		mutex_acquire (&cache_lock);
+		e->pin_cnt--;
+		if (written)
+			writeback_cnt++;
+		mutex_release (&cache_lock);
+	}
+}
+
+/* Reads ahead the sectors queued by cache_readahead(). */
+static void
+cache_readahead_daemon (void *aux UNUSED) {
+	for (;;) {
+		disk_sector_t sector;
+
+		sema_down (&ra_sema);
+		mutex_acquire (&cache_lock);
+		sector = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % CACHE_RA_MAX;
+		ra_cnt--;
+		mutex_release (&cache_lock);
+
+		cache_put (cache_get (sector, true, true), false);
+	}
+}
+
+/* Periodically writes back sectors that have been dirty too long. */
+static void
+cache_writebehind_daemon (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (CACHE_FLUSH_INTERVAL);
+		cache_write_back (CACHE_DIRTY_EXPIRE);
+	}
+}
@@ -2,11 +2,25 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#ifdef VM
+#include "vm/vm.h"
 
-/* An open file. */
+/* File data goes through the page cache, whose pages mmap() maps. */
+#define file_inode_read page_cache_read
+#define file_inode_write page_cache_write
+#else
+#define file_inode_read inode_read_at
+#define file_inode_write inode_write_at
+#endif
+
+/* An open file.
+ * POS_LOCK makes a read or write and the position update that
+ * follows it atomic; the inode does its own locking. */
 struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
+	struct lock pos_lock;       /* Protects pos. */
 	bool deny_write;            /* Has file_deny_write() been called? */
 };
 
@@ -19,6 +33,7 @@ file_open (struct inode *inode) {
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
 		file->pos = 0;
+		lock_init (&file->pos_lock);
 		file->deny_write = false;
 		return file;
 	} else {
@@ -41,7 +56,7 @@ struct file *
 file_duplicate (struct file *file) {
 	struct file *nfile = file_open (inode_reopen (file->inode));
 	if (nfile) {
-		nfile->pos = file->pos;
+		nfile->pos = file_tell (file);
 		if (file->deny_write)
 			file_deny_write (nfile);
 	}
@@ -71,8 +86,12 @@ file_get_inode (struct file *file) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
-	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	off_t bytes_read;
+
+	lock_acquire (&file->pos_lock);
+	bytes_read = file_inode_read (file->inode, buffer, size, file->pos);
 	file->pos += bytes_read;
+	lock_release (&file->pos_lock);
 	return bytes_read;
 }
 
@@ -83,7 +102,7 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	return file_inode_read (file->inode, buffer, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -95,8 +114,12 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
-	off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+	off_t bytes_written;
+
+	lock_acquire (&file->pos_lock);
+	bytes_written = file_inode_write (file->inode, buffer, size, file->pos);
 	file->pos += bytes_written;
+	lock_release (&file->pos_lock);
 	return bytes_written;
 }
 
@@ -110,7 +133,7 @@ file_write (struct file *file, const void *buffer, off_t size) {
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
 		off_t file_ofs) {
-	return inode_write_at (file->inode, buffer, size, file_ofs);
+	return file_inode_write (file->inode, buffer, size, file_ofs);
 }
 
 /* Prevents write operations on FILE's underlying inode
@@ -149,13 +172,20 @@ void
 file_seek (struct file *file, off_t new_pos) {
 	ASSERT (file != NULL);
 	ASSERT (new_pos >= 0);
+	lock_acquire (&file->pos_lock);
 	file->pos = new_pos;
+	lock_release (&file->pos_lock);
 }
 
 /* Returns the current position in FILE as a byte offset from the
  * start of the file. */
 off_t
 file_tell (struct file *file) {
+	off_t pos;
+
 	ASSERT (file != NULL);
-	return file->pos;
+	lock_acquire (&file->pos_lock);
+	pos = file->pos;
+	lock_release (&file->pos_lock);
+	return pos;
 }
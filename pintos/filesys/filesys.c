@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -21,7 +22,9 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	cache_init ();
 	inode_init ();
+	dir_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -50,6 +53,17 @@ filesys_done (void) {
 	fat_close ();
 #else
 	free_map_close ();
+#endif
+	cache_flush ();
+}
+
+/* Prints statistics for the file system's locks. */
+void
+filesys_print_stats (void) {
+	cache_print_stats ();
+	inode_print_stats ();
+#ifndef EFILESYS
+	free_map_print_stats ();
 #endif
 }
 
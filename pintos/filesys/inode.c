@@ -3,9 +3,14 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -26,13 +31,24 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+ *
+ * ELEM, OPEN_CNT, REMOVED and LOADING are protected by
+ * open_inodes_lock.  LOADED is upped once DATA has been read, and
+ * passed on by each opener that waited on it.  RWLOCK admits concurrent readers of the inode's sectors but
+ * serializes writers, whose partial-sector writes are
+ * read-modify-write, and also protects DENY_WRITE_CNT.  DATA is
+ * read once in inode_open() and never changes afterward, since
+ * files do not grow. */
 struct inode {
 	struct list_elem elem;              /* Element in inode list. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
+	bool loading;                       /* DATA still being read? */
+	struct semaphore loaded;            /* Upped once DATA is read. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	struct rwlock rwlock;               /* Reader/writer lock on contents. */
 	struct inode_disk data;             /* Inode content. */
 };
 
@@ -52,11 +68,19 @@ byte_to_sector (const struct inode *inode, off_t pos) {
 /* List of open inodes, so that opening a single inode twice
  * returns the same `struct inode'. */
 static struct list open_inodes;
+static struct mutex open_inodes_lock;
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
 	list_init (&open_inodes);
+	mutex_init (&open_inodes_lock);
+}
+
+/* Prints statistics for the open inode list lock. */
+void
+inode_print_stats (void) {
+	mutex_print_stats (&open_inodes_lock, "open_inodes");
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -81,13 +105,13 @@ inode_create (disk_sector_t sector, off_t length) {
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
 		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
+			cache_write (sector, disk_inode);
 			if (sectors > 0) {
 				static char zeros[DISK_SECTOR_SIZE];
 				size_t i;
 
 				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
+					cache_write (disk_inode->start + i, zeros); 
 			}
 			success = true; 
 		} 
@@ -105,35 +129,62 @@ inode_open (disk_sector_t sector) {
 	struct inode *inode;
 
 	/* Check whether this inode is already open. */
+	mutex_acquire (&open_inodes_lock);
 	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
 			e = list_next (e)) {
 		inode = list_entry (e, struct inode, elem);
 		if (inode->sector == sector) {
-			inode_reopen (inode);
+			bool loading = inode->loading;
+
+			inode->open_cnt++;
+			mutex_release (&open_inodes_lock);
+
+			/* Another opener is still reading it in. */
+			if (loading) {
+				sema_down (&inode->loaded);
+				sema_up (&inode->loaded);
+			}
 			return inode; 
 		}
 	}
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	if (inode == NULL) {
+		mutex_release (&open_inodes_lock);
 		return NULL;
+	}
 
-	/* Initialize. */
+	/* Initialize.  The inode is listed before it is read, marked as
+	 * loading, so that a concurrent opener of the same sector waits
+	 * for this copy instead of reading a second one, while opens of
+	 * other inodes do not wait behind the disk. */
 	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->loading = true;
+	sema_init (&inode->loaded, 0);
+	rwlock_init (&inode->rwlock);
+	mutex_release (&open_inodes_lock);
+
+	cache_read (inode->sector, &inode->data);
+	mutex_acquire (&open_inodes_lock);
+	inode->loading = false;
+	mutex_release (&open_inodes_lock);
+	sema_up (&inode->loaded);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		mutex_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		mutex_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -153,9 +204,16 @@ inode_close (struct inode *inode) {
 		return;
 
 	/* Release resources if this was the last opener. */
+	mutex_acquire (&open_inodes_lock);
 	if (--inode->open_cnt == 0) {
 		/* Remove from inode list and release lock. */
 		list_remove (&inode->elem);
+		mutex_release (&open_inodes_lock);
+
+#ifdef VM
+		/* Cached pages are keyed by INODE, which is about to go. */
+		page_cache_release (inode);
+#endif
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
@@ -165,7 +223,8 @@ inode_close (struct inode *inode) {
 		}
 
 		free (inode); 
-	}
+	} else
+		mutex_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -173,7 +232,9 @@ inode_close (struct inode *inode) {
 void
 inode_remove (struct inode *inode) {
 	ASSERT (inode != NULL);
+	mutex_acquire (&open_inodes_lock);
 	inode->removed = true;
+	mutex_release (&open_inodes_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -183,8 +244,9 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
+	off_t next;
 
+	rwlock_acquire_read (&inode->rwlock);
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -200,27 +262,20 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		cache_read_at (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
+
+	/* Start fetching the sector after the last one read, on the
+	 * guess that the caller is reading sequentially. */
+	next = ROUND_UP (offset, DISK_SECTOR_SIZE);
+	if (bytes_read > 0 && next < inode_length (inode))
+		cache_readahead (byte_to_sector (inode, next));
+	rwlock_release_read (&inode->rwlock);
 
 	return bytes_read;
 }
@@ -235,10 +290,12 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
-	if (inode->deny_write_cnt)
+	rwlock_acquire_write (&inode->rwlock);
+	if (inode->deny_write_cnt) {
+		rwlock_release_write (&inode->rwlock);
 		return 0;
+	}
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
@@ -255,45 +312,58 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		/* The cache reads in the rest of a partially written
+		 * sector itself. */
+		cache_write_at (sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
+	rwlock_release_write (&inode->rwlock);
 
 	return bytes_written;
 }
 
+/* Returns true if reading SIZE bytes from INODE, starting at
+ * OFFSET, would find every sector in the buffer cache. */
+bool
+inode_is_cached (struct inode *inode, off_t size, off_t offset) {
+	off_t end = offset + size < inode_length (inode)
+		? offset + size : inode_length (inode);
+	off_t pos;
+
+	for (pos = offset - offset % DISK_SECTOR_SIZE; pos < end;
+			pos += DISK_SECTOR_SIZE)
+		if (!cache_contains (byte_to_sector (inode, pos)))
+			return false;
+	return true;
+}
+
+/* Asks the buffer cache to read ahead the sectors that hold SIZE
+ * bytes of INODE starting at OFFSET.  Does not wait for the reads,
+ * and as many as the cache has room to queue are started. */
+void
+inode_prefetch (struct inode *inode, off_t size, off_t offset) {
+	off_t end = offset + size < inode_length (inode)
+		? offset + size : inode_length (inode);
+	off_t pos;
+
+	for (pos = offset - offset % DISK_SECTOR_SIZE; pos < end;
+			pos += DISK_SECTOR_SIZE)
+		cache_readahead (byte_to_sector (inode, pos));
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
 inode_deny_write (struct inode *inode) 
 {
+	rwlock_acquire_write (&inode->rwlock);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -301,9 +371,11 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	rwlock_acquire_write (&inode->rwlock);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -1,6 +1,51 @@
 /* page_cache.c: Implementation of Page Cache (Buffer Cache). */
 
 #include "vm/vm.h"
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The page cache needs the frame table, so it only exists in
+ * kernels built with VM. */
+#ifdef VM
+
+/* Page cache.
+ *
+ * Each page of a file that is read, written or mapped is held once,
+ * by a cache page: a struct page of type VM_PAGE_CACHE that lives in
+ * PC_PAGES instead of any SPT and whose frame comes from the frame
+ * table like any other.  read() and write() copy to and from that
+ * frame, and mmap() maps it into each process through a page of the
+ * same type that shares it, so there is one copy of the data however
+ * many processes use it.
+ *
+ * write() goes through to the inode right away, so only stores
+ * through a mapping leave a frame newer than the file.  Those are
+ * seen in the mappings' dirty bits and written back when the
+ * mapping goes away, when the frame is evicted, or by the worker
+ * thread every PC_FLUSH_INTERVAL ticks, which keeps most frames
+ * clean by the time eviction gets to them.
+ *
+ * The worker also reads ahead.  A miss on a page whose predecessor
+ * is cached starts a window of PC_RA_PAGES pages after it; the first
+ * use of each page read ahead then asks for one more page at the end
+ * of the window, so a sequential reader finds its pages already
+ * there. */
+
+/* Ticks between write-back passes, and most frames per pass. */
+#define PC_FLUSH_INTERVAL (5 * TIMER_FREQ)
+#define PC_FLUSH_BATCH 64
+
+/* Pages kept read ahead of a sequential reader, and most pending
+ * read-ahead requests. */
+#define PC_RA_PAGES 4
+#define PC_RA_MAX 16
+
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
@@ -15,36 +60,593 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
+/* Cache pages keyed by inode and offset, and the lock that protects
+ * the table and each cache page's BUSY flag.  PC_LOADED is
+ * signaled whenever a page stops being busy. */
+static struct hash pc_pages;
+static struct lock pc_lock;
+static struct condition pc_loaded;
+
+/* Pending read-ahead requests, a ring protected by pc_lock.  Each
+ * holds a reference to its inode. */
+struct pc_ra_request {
+	struct inode *inode;
+	off_t ofs;                  /* First page to read. */
+	size_t page_cnt;            /* Number of pages. */
+};
+static struct pc_ra_request pc_ra_queue[PC_RA_MAX];
+static size_t pc_ra_head, pc_ra_cnt;
+
+/* The worker sleeps on PC_WORK, which is upped once per read-ahead
+ * request and once per PC_FLUSH_TIMER expiry. */
+static struct semaphore pc_work;
+static struct timer_event pc_flush_timer;
+static volatile bool pc_flush_due;
+
+/* Statistics, protected by pc_lock except for those of the worker's
+ * write-back passes, which only the worker updates. */
+static long long pc_hit_cnt;    /* Lookups that found the page resident. */
+static long long pc_miss_cnt;   /* Lookups that had to read it in. */
+static long long pc_readahead_cnt; /* Pages read in by the worker. */
+static long long pc_flush_cnt;  /* Frames written back by the worker. */
+static long long pc_run_cnt;    /* ...in this many sequential runs. */
+
+static void page_cache_kworkerd (void *aux);
+static void page_cache_flush_tick (void *aux);
+
+static uint64_t pc_hash (const struct hash_elem *, void *);
+static bool pc_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	if (!hash_init (&pc_pages, pc_hash, pc_less, NULL))
+		PANIC ("out of memory for page cache");
+	lock_init (&pc_lock);
+	cond_init (&pc_loaded);
+	pc_ra_head = pc_ra_cnt = 0;
+	sema_init (&pc_work, 0);
+	timer_event_init (&pc_flush_timer, page_cache_flush_tick, NULL);
+
+	page_cache_workerd = thread_create ("pc_worker", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	if (page_cache_workerd == TID_ERROR)
+		PANIC ("cannot start page cache worker");
+	timer_event_arm (&pc_flush_timer, timer_ticks () + PC_FLUSH_INTERVAL);
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Page cache: %zu pages, %lld hits, %lld misses, "
+			"%lld read-aheads, %lld write-backs in %lld runs\n",
+			hash_size (&pc_pages), pc_hit_cnt, pc_miss_cnt, pc_readahead_cnt,
+			pc_flush_cnt, pc_run_cnt);
 }
 
-/* Initialize the page cache */
+/* Initialize the page cache
+ * Only a process's mapping is created through uninit_new(); its aux
+ * is the struct file_segment it maps, whose inode reference the page
+ * keeps.  The data is already in KVA, the cache page's frame. */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
+	struct file_segment *seg = page->uninit.aux;
+
+	if (seg == NULL)
+		return false;
+
 	/* Set up the handler */
 	page->operations = &page_cache_op;
 
+	page->page_cache.seg = *seg;
+	page->page_cache.busy = false;
+	page->page_cache.readahead = false;
+	free (seg);
+	return true;
+}
+
+/* Returns the segment that mapping PAGE maps, whether or not it has
+ * been initialized yet. */
+static struct file_segment *
+page_cache_segment (struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return page->uninit.aux;
+	return &page->page_cache.seg;
+}
+
+/* Returns a new, non-resident cache page for the page of INODE at
+ * OFS, or a null pointer if memory is exhausted.  It holds no
+ * reference to INODE; page_cache_release() drops it before INODE is
+ * freed. */
+static struct page *
+page_cache_new (struct inode *inode, off_t ofs) {
+	struct page *page = malloc (sizeof *page);
+	off_t left = inode_length (inode) - ofs;
+
+	if (page == NULL)
+		return NULL;
+	page->operations = &page_cache_op;
+	page->va = NULL;
+	page->frame = NULL;
+	page->pml4 = NULL;
+	page->owner = NULL;
+	page->writable = false;
+	page->page_cache.seg.inode = inode;
+	page->page_cache.seg.ofs = ofs;
+	page->page_cache.seg.read_bytes = left < 0 ? 0 : left < PGSIZE ? left : PGSIZE;
+	page->page_cache.busy = false;
+	page->page_cache.readahead = false;
+	return page;
 }
 
-/* Utilze the Swap in mechanism to implement readhead */
+/* Asks the worker to read PAGE_CNT pages of INODE starting at OFS
+ * into the cache, unless OFS is past the end of the file or too
+ * many requests are pending.  Does not wait for the reads. */
+static void
+page_cache_queue_readahead (struct inode *inode, off_t ofs, size_t page_cnt) {
+	bool queued = false;
+
+	if (ofs >= inode_length (inode))
+		return;
+
+	lock_acquire (&pc_lock);
+	if (pc_ra_cnt < PC_RA_MAX) {
+		pc_ra_queue[(pc_ra_head + pc_ra_cnt) % PC_RA_MAX] =
+			(struct pc_ra_request) {
+				.inode = inode_reopen (inode),
+				.ofs = ofs,
+				.page_cnt = page_cnt,
+			};
+		pc_ra_cnt++;
+		queued = true;
+	}
+	lock_release (&pc_lock);
+
+	if (queued)
+		sema_up (&pc_work);
+}
+
+/* Returns the cache page for the page of INODE at OFS, which must be
+ * page-aligned, reading it in if needed.  Its frame is pinned; the
+ * caller unpins it with vm_unpin_page().  Returns a null pointer if
+ * memory is exhausted.  READAHEAD is true for the worker's reads,
+ * which are not counted as hits or misses. */
+static struct page *
+page_cache_get (struct inode *inode, off_t ofs, bool readahead) {
+	struct page key, *page;
+	struct hash_elem *e;
+	bool success, advance = false;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	lock_acquire (&pc_lock);
+	key.page_cache.seg.inode = inode;
+	key.page_cache.seg.ofs = ofs;
+	e = hash_find (&pc_pages, &key.page_cache.elem);
+	if (e != NULL)
+		page = hash_entry (e, struct page, page_cache.elem);
+	else {
+		page = page_cache_new (inode, ofs);
+		if (page == NULL) {
+			lock_release (&pc_lock);
+			return NULL;
+		}
+		hash_insert (&pc_pages, &page->page_cache.elem);
+	}
+
+	/* Only one thread reads a page in; the others wait for it. */
+	while (page->page_cache.busy)
+		cond_wait (&pc_loaded, &pc_lock);
+	if (vm_pin_resident (page)) {
+		if (!readahead) {
+			pc_hit_cnt++;
+			advance = page->page_cache.readahead;
+			page->page_cache.readahead = false;
+		}
+		lock_release (&pc_lock);
+
+		/* The reader has caught up with a page read ahead for it, so
+		 * keep the window PC_RA_PAGES ahead. */
+		if (advance)
+			page_cache_queue_readahead (inode, ofs + PC_RA_PAGES * PGSIZE, 1);
+		return page;
+	}
+	if (readahead)
+		pc_readahead_cnt++;
+	else
+		pc_miss_cnt++;
+	page->page_cache.busy = true;
+	page->page_cache.readahead = readahead;
+	lock_release (&pc_lock);
+
+	success = vm_pin_page (page);
+
+	lock_acquire (&pc_lock);
+	page->page_cache.busy = false;
+	cond_broadcast (&pc_loaded, &pc_lock);
+	lock_release (&pc_lock);
+	return success ? page : NULL;
+}
+
+/* Returns the frame of the cache page that mapping PAGE maps,
+ * pinned and filled, or a null pointer if memory is exhausted. */
+struct frame *
+page_cache_get_frame (struct page *page) {
+	struct file_segment *seg = page_cache_segment (page);
+	struct page *cache_page = page_cache_get (seg->inode, seg->ofs, false);
+
+	return cache_page != NULL ? cache_page->frame : NULL;
+}
+
+/* Returns true if the cache page for SEG is resident and not being
+ * read in, so that page_cache_get_frame() on a mapping of it would
+ * not wait.  The answer may be out of date by the time the caller
+ * acts on it. */
+bool
+page_cache_is_resident (const struct file_segment *seg) {
+	struct page key;
+	struct hash_elem *e;
+	bool resident = false;
+
+	lock_acquire (&pc_lock);
+	key.page_cache.seg.inode = seg->inode;
+	key.page_cache.seg.ofs = seg->ofs;
+	e = hash_find (&pc_pages, &key.page_cache.elem);
+	if (e != NULL) {
+		struct page *page = hash_entry (e, struct page, page_cache.elem);
+		resident = page->frame != NULL && !page->page_cache.busy;
+	}
+	lock_release (&pc_lock);
+	return resident;
+}
+
+/* Asks the worker to read PAGE_CNT pages of SEG's file, starting
+ * with SEG's, into the cache.  Does not wait for the reads. */
+void
+page_cache_prefetch (const struct file_segment *seg, size_t page_cnt) {
+	page_cache_queue_readahead (seg->inode, seg->ofs, page_cnt);
+}
+
+/* Reads SIZE bytes of INODE starting at OFFSET into BUFFER through
+ * the page cache.  Returns the number of bytes read, which is short
+ * at end of file or if memory is exhausted. */
+off_t
+page_cache_read (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
+	uint8_t *buffer = buffer_;
+	off_t bytes_read = 0;
+
+	/* The file system is used before pagecache_init() runs. */
+	if (pc_pages.buckets == NULL)
+		return inode_read_at (inode, buffer_, size, offset);
+
+	while (size > 0) {
+		off_t page_ofs = offset % PGSIZE;
+		off_t inode_left = inode_length (inode) - offset;
+		off_t page_left = PGSIZE - page_ofs;
+		off_t min_left = inode_left < page_left ? inode_left : page_left;
+		off_t chunk_size = size < min_left ? size : min_left;
+		struct page *page;
+
+		if (chunk_size <= 0)
+			break;
+		page = page_cache_get (inode, offset - page_ofs, false);
+		if (page == NULL)
+			break;
+		memcpy (buffer + bytes_read, (uint8_t *) page->frame->kva + page_ofs,
+				chunk_size);
+		vm_unpin_page (page);
+
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_read += chunk_size;
+	}
+	return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE starting at OFFSET
+ * through the page cache.  Each piece is copied into the cache page
+ * and then written to the inode from there, so that the inode never
+ * sees a user buffer that could fault while it is locked.  Returns
+ * the number of bytes written, which is short at end of file, if
+ * writes are denied or if memory is exhausted. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t bytes_written = 0;
+
+	if (pc_pages.buckets == NULL)
+		return inode_write_at (inode, buffer_, size, offset);
+
+	while (size > 0) {
+		off_t page_ofs = offset % PGSIZE;
+		off_t inode_left = inode_length (inode) - offset;
+		off_t page_left = PGSIZE - page_ofs;
+		off_t min_left = inode_left < page_left ? inode_left : page_left;
+		off_t chunk_size = size < min_left ? size : min_left;
+		struct page *page;
+		uint8_t *kva;
+		off_t written;
+
+		if (chunk_size <= 0)
+			break;
+		page = page_cache_get (inode, offset - page_ofs, false);
+		if (page == NULL)
+			break;
+		kva = (uint8_t *) page->frame->kva + page_ofs;
+		memcpy (kva, buffer + bytes_written, chunk_size);
+		written = inode_write_at (inode, kva, chunk_size, offset);
+		if (written < chunk_size)
+			/* Put back what did not reach the inode. */
+			inode_read_at (inode, kva + written, chunk_size - written,
+					offset + written);
+		vm_unpin_page (page);
+
+		size -= written;
+		offset += written;
+		bytes_written += written;
+		if (written < chunk_size)
+			break;
+	}
+	return bytes_written;
+}
+
+/* Drops every cache page of INODE.  Called when its last opener
+ * closes it; by then no process maps it, so no page is dirty. */
+void
+page_cache_release (struct inode *inode) {
+	off_t ofs;
+
+	if (pc_pages.buckets == NULL)
+		return;
+
+	for (ofs = 0; ofs < inode_length (inode); ofs += PGSIZE) {
+		struct page key, *page = NULL;
+		struct hash_elem *e;
+
+		lock_acquire (&pc_lock);
+		key.page_cache.seg.inode = inode;
+		key.page_cache.seg.ofs = ofs;
+		e = hash_delete (&pc_pages, &key.page_cache.elem);
+		if (e != NULL)
+			page = hash_entry (e, struct page, page_cache.elem);
+		lock_release (&pc_lock);
+
+		if (page != NULL)
+			vm_dealloc_page (page);
+	}
+}
+
+/* Returns true if the page of INODE before OFS is cached and
+ * resident, which suggests that INODE is being read in order. */
+static bool
+page_cache_follows_resident (struct inode *inode, off_t ofs) {
+	struct page key;
+	struct hash_elem *e;
+	bool resident;
+
+	if (ofs == 0)
+		return true;
+	lock_acquire (&pc_lock);
+	key.page_cache.seg.inode = inode;
+	key.page_cache.seg.ofs = ofs - PGSIZE;
+	e = hash_find (&pc_pages, &key.page_cache.elem);
+	resident = e != NULL
+		&& hash_entry (e, struct page, page_cache.elem)->frame != NULL;
+	lock_release (&pc_lock);
+	return resident;
+}
+
+/* Utilze the Swap in mechanism to implement readhead
+ * A cache page is read from its file, and if that looks like part
+ * of a sequential scan, the worker is asked to read the pages after
+ * it.  A mapping has nothing to read: KVA is the cache page's frame,
+ * already filled. */
 static bool
 page_cache_readahead (struct page *page, void *kva) {
+	struct file_segment *seg = &page->page_cache.seg;
+
+	if (page->pml4 != NULL)
+		return true;
+	if (!file_segment_load (seg, kva))
+		return false;
+	if (!page->page_cache.readahead
+			&& page_cache_follows_resident (seg->inode, seg->ofs))
+		page_cache_queue_readahead (seg->inode, seg->ofs + PGSIZE,
+				PC_RA_PAGES);
+	return true;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
+/* Writes the part of the frame at KVA that belongs to SEG's file
+ * back to it. */
+static void
+page_cache_write_out (const struct file_segment *seg, void *kva) {
+	inode_write_at (seg->inode, kva, seg->read_bytes, seg->ofs);
+}
+
+/* Utilze the Swap out mechanism to implement writeback
+ * Called with the frame table locked, on the cache page of a frame
+ * being evicted.  The frame goes back to the file if any mapping
+ * of it was written to.  A frame that only read() and write() used
+ * is never newer than the file and is just dropped. */
 static bool
 page_cache_writeback (struct page *page) {
+	struct frame *frame = page->frame;
+	bool dirty = false;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *map = list_entry (e, struct page, frame_elem);
+
+		if (map->pml4 != NULL && pml4_is_dirty (map->pml4, map->va)) {
+			pml4_set_dirty (map->pml4, map->va, false);
+			dirty = true;
+		}
+	}
+	if (dirty)
+		page_cache_write_out (&page->page_cache.seg, frame->kva);
+	return true;
 }
 
-/* Destory the page_cache. */
+/* Destory the page_cache.
+ * A mapping writes back what its process wrote through it and lets
+ * go of the cache page's frame, which stays cached. */
 static void
 page_cache_destroy (struct page *page) {
+	struct page_cache *page_cache = &page->page_cache;
+
+	if (page->pml4 != NULL && vm_pin_resident (page)) {
+		if (pml4_is_dirty (page->pml4, page->va)) {
+			page_cache_write_out (&page_cache->seg, page->frame->kva);
+			pml4_set_dirty (page->pml4, page->va, false);
+		}
+		vm_unpin_page (page);
+	}
+	vm_free_frame (page);
+	if (page->pml4 != NULL)
+		inode_close (page_cache->seg.inode);
+}
+
+/* Reads the pages of REQ into the cache and drops its inode
+ * reference. */
+static void
+page_cache_do_readahead (struct pc_ra_request *req) {
+	size_t i;
+
+	for (i = 0; i < req->page_cnt; i++) {
+		off_t ofs = req->ofs + i * PGSIZE;
+		struct page *page;
+
+		if (ofs >= inode_length (req->inode))
+			break;
+		page = page_cache_get (req->inode, ofs, true);
+		if (page == NULL)
+			break;
+		vm_unpin_page (page);
+	}
+	inode_close (req->inode);
+}
+
+/* Returns true if the cache page A is the one just before B in the
+ * same file. */
+static bool
+pc_adjacent (const struct page *a, const struct page *b) {
+	return a->page_cache.seg.inode == b->page_cache.seg.inode
+		&& a->page_cache.seg.ofs + PGSIZE == b->page_cache.seg.ofs;
+}
+
+/* Writes back up to PC_FLUSH_BATCH frames that processes have
+ * written to through their mappings.  They are sorted by file and
+ * offset first, so that adjacent dirty pages go out back to back as
+ * one sequential run instead of in hash order. */
+static void
+page_cache_flush (void) {
+	static struct page *batch[PC_FLUSH_BATCH];
+	struct hash_iterator it;
+	size_t n = 0, i, j;
+
+	/* Each frame is pinned, and its file held open, until written. */
+	lock_acquire (&pc_lock);
+	hash_first (&it, &pc_pages);
+	while (n < PC_FLUSH_BATCH && hash_next (&it)) {
+		struct page *page = hash_entry (hash_cur (&it), struct page,
+				page_cache.elem);
+
+		if (!page->page_cache.busy && vm_pin_dirty (page)) {
+			inode_reopen (page->page_cache.seg.inode);
+			batch[n++] = page;
+		}
+	}
+	lock_release (&pc_lock);
+
+	/* Insertion sort; batches are small. */
+	for (i = 1; i < n; i++) {
+		struct page *page = batch[i];
+
+		for (j = i; j > 0 && pc_less (&page->page_cache.elem,
+					&batch[j - 1]->page_cache.elem, NULL); j--)
+			batch[j] = batch[j - 1];
+		batch[j] = page;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct page *page = batch[i];
+		struct inode *inode = page->page_cache.seg.inode;
+
+		if (i == 0 || !pc_adjacent (batch[i - 1], page))
+			pc_run_cnt++;
+		page_cache_write_out (&page->page_cache.seg, page->frame->kva);
+		vm_unpin_page (page);
+		inode_close (inode);
+	}
+	pc_flush_cnt += n;
 }
 
-/* Worker thread for page cache */
+/* Timer callback that tells the worker to write back. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_flush_tick (void *aux UNUSED) {
+	pc_flush_due = true;
+	sema_up (&pc_work);
 }
+
+/* Worker thread for page cache
+ * Serves read-ahead requests as they come and writes back every
+ * PC_FLUSH_INTERVAL ticks, so that neither readers nor eviction
+ * wait for that I/O.  vm_init() starts it in every kernel with VM. */
+static void
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		struct pc_ra_request req;
+		bool have_req;
+
+		sema_down (&pc_work);
+
+		lock_acquire (&pc_lock);
+		have_req = pc_ra_cnt > 0;
+		if (have_req) {
+			req = pc_ra_queue[pc_ra_head];
+			pc_ra_head = (pc_ra_head + 1) % PC_RA_MAX;
+			pc_ra_cnt--;
+		}
+		lock_release (&pc_lock);
+		if (have_req)
+			page_cache_do_readahead (&req);
+
+		if (pc_flush_due) {
+			pc_flush_due = false;
+			page_cache_flush ();
+			timer_event_arm (&pc_flush_timer,
+					timer_ticks () + PC_FLUSH_INTERVAL);
+		}
+	}
+}
+
+/* Returns a hash value for the cache page that E belongs to. */
+static uint64_t
+pc_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *page = hash_entry (e, struct page, page_cache.elem);
+	const struct file_segment *seg = &page->page_cache.seg;
+
+	return hash_bytes (&seg->inode, sizeof seg->inode)
+		^ hash_int (seg->ofs / PGSIZE);
+}
+
+/* Returns true if the cache page for A precedes the one for B. */
+static bool
+pc_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	const struct file_segment *sa =
+		&hash_entry (a, struct page, page_cache.elem)->page_cache.seg;
+	const struct file_segment *sb =
+		&hash_entry (b, struct page, page_cache.elem)->page_cache.seg;
+
+	if (sa->inode != sb->inode)
+		return sa->inode < sb->inode;
+	return sa->ofs < sb->ofs;
+}
+
+#endif /* VM */
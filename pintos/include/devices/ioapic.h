@@ -0,0 +1,6 @@
+#ifndef DEVICES_IOAPIC_H
+#define DEVICES_IOAPIC_H
+
+void ioapic_init (void);
+
+#endif /* devices/ioapic.h */
@@ -0,0 +1,25 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Interrupt vectors delivered by the local APIC.  The 8259 PICs
+   own 0x20...0x2f; these follow them so that they are still
+   treated as external interrupts. */
+#define LAPIC_TIMER_VEC 0x30    /* Per-CPU timer. */
+#define LAPIC_RESCHED_VEC 0x31  /* Reschedule IPI. */
+#define LAPIC_TLB_VEC 0x32      /* TLB shootdown IPI. */
+#define LAPIC_SPURIOUS_VEC 0xff /* Spurious interrupt. */
+
+bool lapic_present (void);
+void lapic_init (bool bsp);
+uint8_t lapic_id (void);
+void lapic_eoi (void);
+void lapic_send_ipi (uint8_t apic_id, uint8_t vec);
+bool lapic_start_ap (uint8_t apic_id, uint64_t trampoline);
+
+void lapic_timer_calibrate (void);
+void lapic_timer_start (void);
+
+#endif /* devices/lapic.h */
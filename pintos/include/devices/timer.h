@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -20,4 +22,21 @@ void timer_nsleep (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* Kernel timer event.
+   When the timer tick reaches EXPIRES, FUNC is called with AUX
+   from the timer interrupt handler, so FUNC must not sleep. */
+typedef void timer_event_func (void *aux);
+
+struct timer_event {
+	int64_t expires;            /* Tick at which to fire. */
+	timer_event_func *func;     /* Callback. */
+	void *aux;                  /* Callback argument. */
+	bool armed;                 /* On the timer wheel? */
+	struct list_elem elem;      /* Timer wheel slot element. */
+};
+
+void timer_event_init (struct timer_event *, timer_event_func *, void *aux);
+void timer_event_arm (struct timer_event *, int64_t expires);
+bool timer_event_cancel (struct timer_event *);
+
 #endif /* devices/timer.h */
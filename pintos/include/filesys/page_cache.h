@@ -1,12 +1,33 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
+#include <hash.h>
+#include "filesys/off_t.h"
 #include "vm/vm.h"
 
 struct page;
+struct frame;
+struct inode;
 enum vm_type;
 
-struct page_cache {};
+/* A VM_PAGE_CACHE page is either the cache's own page for one page
+ * of a file, which is in no SPT and has a null PML4, or a process's
+ * mapping of that page from mmap(), which shares the cache page's
+ * frame. */
+struct page_cache {
+	struct file_segment seg;     /* Part of the file held. */
+	struct hash_elem elem;       /* Element in the cache, if the cache's. */
+	bool busy;                   /* Cache's page being brought in? */
+	bool readahead;              /* Read ahead and not used since? */
+};
 
-void page_cache_init (void);
+void pagecache_init (void);
+void page_cache_print_stats (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+struct frame *page_cache_get_frame (struct page *page);
+bool page_cache_is_resident (const struct file_segment *);
+void page_cache_prefetch (const struct file_segment *, size_t page_cnt);
+off_t page_cache_read (struct inode *, void *, off_t size, off_t offset);
+off_t page_cache_write (struct inode *, const void *, off_t size,
+		off_t offset);
+void page_cache_release (struct inode *);
 #endif
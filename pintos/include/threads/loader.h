@@ -25,6 +25,11 @@
 #define LOADER_ARGS (LOADER_SIG - LOADER_ARGS_LEN)     /* Command-line args. */
 #define LOADER_ARG_CNT (LOADER_ARGS - LOADER_ARG_CNT_LEN) /* Number of args. */
 
+/* Physical address where application processors start running
+   (threads/start.S).  A start-up IPI can only name a page below
+   1 MB. */
+#define AP_TRAMPOLINE 0x8000
+
 /* Sizes of loader data structures. */
 #define LOADER_SIG_LEN 2
 #define LOADER_ARGS_LEN 128
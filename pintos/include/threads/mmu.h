@@ -2,19 +2,53 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func (uint64_t *pte, void *va, void *aux);
 
+/* Address spaces a TLB gather tracks before it has to flush. */
+#define TLB_GATHER_SPACES 4
+
+/* TLB invalidations held back while a batch of pages is unmapped.
+ * Between tlb_gather_begin() and tlb_gather_end(), pml4_clear_page()
+ * on the running thread only widens the range of pages changed in
+ * its pml4 here; tlb_gather_end() then invalidates each range once.
+ * Until then, stale translations can only be used by user code
+ * running in a gathered pml4.  Processes are single-threaded, so a
+ * frame mapped only in the running process's own pml4, or in one
+ * that no thread runs, may be freed inside the gather, as
+ * supplemental_page_table_kill() and do_munmap() do: the only thread
+ * that could use it does not return to user mode before the end.
+ * A frame of a process that may be running elsewhere, as in
+ * eviction, must not be used again before the end. */
+struct tlb_gather {
+	size_t cnt;                         /* Ranges in use. */
+	struct tlb_range {
+		uint64_t *pml4;                 /* Address space. */
+		uint64_t start, end;            /* Pages changed, [START, END). */
+	} ranges[TLB_GATHER_SPACES];
+};
+
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create);
 uint64_t *pml4_create (void);
 bool pml4_for_each (uint64_t *, pte_for_each_func *, void *);
 void pml4_destroy (uint64_t *pml4);
+void pml4_init_cpu (void);
 void pml4_activate (uint64_t *pml4);
+void pml4_flush (uint64_t *pml4);
+void pml4_print_stats (void);
+void tlb_gather_begin (struct tlb_gather *);
+void tlb_gather_end (struct tlb_gather *);
+void tlb_shootdown_interrupt (void);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_split_huge_page (uint64_t *pml4, void *upage);
 void pml4_clear_page (uint64_t *pml4, void *upage);
+void pml4_set_writable (uint64_t *pml4, void *upage, bool writable);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
@@ -23,6 +57,7 @@ void pml4_set_accessed (uint64_t *pml4, const void *upage, bool accessed);
 #define is_writable(pte) (*(pte) & PTE_W)
 #define is_user_pte(pte) (*(pte) & PTE_U)
 #define is_kern_pte(pte) (!is_user_pte (pte))
+#define is_huge_pte(pte) (*(pte) & PTE_PS)
 
 #define pte_get_paddr(pte) (pg_round_down(*(pte)))
 
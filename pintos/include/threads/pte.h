@@ -28,6 +28,12 @@
 #define PTX(la)  ((((uint64_t) (la)) >> PTXSHIFT) & 0x1FF)
 #define PTE_ADDR(pte) ((uint64_t) (pte) & ~0xFFF)
 
+/* A page directory entry with PTE_PS set maps a 2 MB huge page
+ * directly instead of pointing to a page table. */
+#define HPGSHIFT PDXSHIFT                    /* Index of first huge page offset bit. */
+#define HPGSIZE  (1UL << HPGSHIFT)           /* Bytes in a huge page. */
+#define HPGMASK  (HPGSIZE - 1)               /* Huge page offset bits. */
+
 /* The important flags are listed below.
    When a PDE or PTE is not "present", the other flags are
    ignored.
@@ -39,7 +45,10 @@
 #define PTE_P 0x1                        /* 1=present, 0=not present. */
 #define PTE_W 0x2                        /* 1=read/write, 0=read-only. */
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
+#define PTE_PWT 0x8                      /* 1=write-through caching. */
+#define PTE_PCD 0x10                     /* 1=cache disabled. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=2 MB huge page (PDEs only). */
 
 #endif /* threads/pte.h */
@@ -0,0 +1,68 @@
+#ifndef THREADS_SMP_H
+#define THREADS_SMP_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/spinlock.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* 지원하는 최대 CPU 수. */
+#define NCPU_MAX 16
+
+/* CPU별 상태.
+ *
+ * 실행 중인 스레드는 자신이 돌고 있는 CPU를 `cpu' 멤버로 가리키므로
+ * this_cpu()는 스택 포인터만으로 현재 CPU를 찾습니다. 스레드는
+ * 자신의 CPU에서 인터럽트가 꺼진 동안에는 다른 CPU로 옮겨지지
+ * 않으므로, 인터럽트를 끈 상태에서 얻은 포인터는 안전합니다. */
+struct cpu {
+	/* syscall-entry.S가 %gs를 통해 접근합니다. 순서를 바꾸지 마세요. */
+	struct task_state *tss;         /* 이 CPU의 TSS. */
+	uint64_t syscall_scratch[2];    /* 시스템 호출 진입 시 임시 저장소. */
+
+	int id;                         /* cpus[] 안의 인덱스. */
+	uint8_t lapic_id;               /* Local APIC ID. */
+	volatile bool started;          /* 스케줄러가 돌고 있는가? */
+
+	/* 실행 큐. rq_lock이 아래 멤버와 이 CPU의 스레드 상태 전환을
+	   보호합니다. 문맥 전환 중에는 전환을 시작한 CPU가 rq_lock을
+	   잡고 있다가, 전환되어 들어온 스레드가 놓아 줍니다. */
+	struct spinlock rq_lock;
+	struct list ready_queues[PRI_MAX + 1]; /* 우선순위별 FIFO 큐. */
+	uint64_t ready_mask;            /* 비어 있지 않은 큐의 비트맵. */
+	int ready_count;                /* 준비된 스레드 수. */
+	struct thread *curr;            /* 실행 중인 스레드. */
+	struct thread *idle_thread;     /* 이 CPU의 idle 스레드. */
+	struct list destruction_req;    /* 해제를 기다리는 스레드. */
+
+	unsigned thread_ticks;          /* 마지막 yield 이후의 타이머 틱 수. */
+	int64_t steal_after;            /* 이 틱 전에는 훔치기를 쉽니다. */
+	bool in_external_intr;          /* 외부 인터럽트 처리 중인가? */
+	bool yield_on_return;           /* 인터럽트 복귀 시 양보할 것인가? */
+
+	/* 통계. */
+	long long idle_ticks;           /* Idle 상태에서 보낸 타이머 틱 수. */
+	long long kernel_ticks;         /* 커널 스레드의 타이머 틱 수. */
+	long long user_ticks;           /* 사용자 프로그램의 타이머 틱 수. */
+	long long steals;               /* 다른 CPU에서 훔쳐 온 횟수. */
+	long long migrations;           /* 훔쳐 오면서 옮긴 스레드 수. */
+};
+
+extern struct cpu cpus[NCPU_MAX];
+extern int cpu_cnt;
+
+/* -smp=N: 부팅할 CPU 수. */
+extern int smp_requested_cpus;
+
+/* 현재 CPU를 반환합니다. */
+static inline struct cpu *
+this_cpu (void) {
+	return ((struct thread *) pg_round_down (rrsp ()))->cpu;
+}
+
+void smp_init (void);
+
+#endif /* threads/smp.h */
@@ -0,0 +1,29 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct cpu;
+
+/* 스핀락.
+   다른 CPU와의 상호 배제를 위해 바쁜 대기를 합니다. 같은 CPU의
+   인터럽트 핸들러와의 상호 배제는 호출자가 인터럽트를 꺼서
+   보장해야 하므로, 스핀락은 항상 인터럽트가 꺼진 상태에서만
+   잡을 수 있습니다. 스핀락을 잡은 채로 잠들어서는 안 됩니다. */
+struct spinlock {
+	volatile int locked;        /* 잠겨 있으면 1. */
+	struct cpu *cpu;            /* 소유 CPU (디버깅용). */
+	const char *name;           /* 이름 (디버깅용). */
+};
+
+/* 정적으로 선언한 스핀락을 위한 초기값. */
+#define SPINLOCK_INITIALIZER(NAME) { 0, NULL, NAME }
+
+void spinlock_init (struct spinlock *, const char *name);
+void spin_lock (struct spinlock *);
+bool spin_trylock (struct spinlock *);
+void spin_unlock (struct spinlock *);
+bool spin_holding (const struct spinlock *);
+
+#endif /* threads/spinlock.h */
@@ -3,11 +3,14 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/spinlock.h"
 
 /* A counting semaphore. */
 struct semaphore {
 	unsigned value;             /* Current value. */
 	struct list waiters;        /* List of waiting threads. */
+	struct spinlock lock;       /* Protects the two members above. */
 };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -16,10 +19,18 @@ bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
-/* Lock. */
+/* Lock.
+
+   Priority donation is tracked per lock: MAX_PRIORITY caches the
+   highest priority among the lock's waiters, and the holder keeps
+   the locks it holds in HELD_LOCKS ordered by that value, so the
+   holder's donated priority is always at the front.  The
+   semaphore's waiters are kept in priority order as well. */
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
+	int max_priority;           /* Highest waiter priority, or PRI_MIN - 1. */
+	struct list_elem elem;      /* Element in holder's held_locks. */
 };
 
 void lock_init (struct lock *);
@@ -27,6 +38,89 @@ void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+bool lock_priority_compare (const struct list_elem *a, const struct list_elem *b, void *aux);
+
+/* Adaptive mutex.
+
+   A lock that, when contended, first spins while the holder is
+   running on another CPU, on the bet that it will release the
+   lock sooner than a context switch would take, and only then
+   blocks on the underlying lock.  Blocking goes through
+   lock_acquire(), so priority donation works as for a lock.
+   The statistics are only updated by the holder. */
+struct mutex {
+	struct lock lock;               /* Underlying blocking lock. */
+
+	/* Statistics. */
+	long long acquisitions;         /* Successful acquires. */
+	long long contended;            /* Acquires that found it held. */
+	long long spins;                /* Spin iterations. */
+	long long blocks;               /* Acquires that had to block. */
+	int64_t block_ticks;            /* Timer ticks spent blocked. */
+};
+
+void mutex_init (struct mutex *);
+void mutex_acquire (struct mutex *);
+bool mutex_try_acquire (struct mutex *);
+void mutex_release (struct mutex *);
+bool mutex_held_by_current_thread (const struct mutex *);
+void mutex_print_stats (const struct mutex *, const char *name);
+
+/* Readers-writer lock.
+
+   Any number of readers or a single writer may hold it at once.
+   Once a writer is waiting, new readers queue up behind it, so a
+   steady stream of readers cannot starve writers.  Ownership is
+   handed directly to the threads that are woken: a releasing
+   writer passes the lock to the highest-priority waiting writer,
+   or to every waiting reader if no writer waits.  A thread blocked
+   on an rwlock donates its priority to all current holders.
+
+   Neither side is recursive: a thread that already holds an
+   rwlock in either mode must not acquire it again.  As with locks,
+   MAX_PRIORITY caches the highest priority among the waiters, whose
+   lists are kept in priority order.  All members are protected by
+   donation_lock. */
+struct rwlock {
+	int readers;                /* Number of readers holding it. */
+	struct thread *writer;      /* Writer holding it, or NULL. */
+	int max_priority;           /* Highest waiter priority, or PRI_MIN - 1. */
+	struct list holds;          /* Holders' struct rwlock_hold. */
+	struct list read_waiters;   /* Blocked readers' holds. */
+	struct list write_waiters;  /* Blocked writers' holds. */
+};
+
+/* One thread's hold on an rwlock, in either mode, from the time it
+   starts waiting for it.  A thread keeps the holds of the rwlocks it
+   holds in its rwlock_holds, ordered by their max_priority, so that
+   its donated priority is at the front, and reuses released holds
+   from its rwlock_spares. */
+struct rwlock_hold {
+	struct rwlock *rwlock;      /* Held or awaited rwlock. */
+	struct thread *thread;      /* Thread that owns this hold. */
+	bool write;                 /* Write mode? */
+	struct list_elem elem;      /* Element in rwlock's lists, or spare. */
+	struct list_elem thread_elem; /* Element in thread's rwlock_holds. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+bool rwlock_try_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_read_held_by_current_thread (const struct rwlock *);
+bool rwlock_write_held_by_current_thread (const struct rwlock *);
+bool rwlock_priority_compare (const struct list_elem *a, const struct list_elem *b, void *aux);
+bool rwlock_waiter_compare (const struct list_elem *a, const struct list_elem *b, void *aux);
+void rwlock_free_spares (void);
+
+/* Protects priority donation state: every lock's holder,
+   max_priority and elem, every rwlock, and every thread's
+   waiting_lock, waiting_hold, rwlock_holds and held_locks.
+   Taken before any semaphore's lock. */
+extern struct spinlock donation_lock;
 
 bool sema_priority_compare (const struct list_elem *a, const struct list_elem *b, void *aux);
 /* Condition variable. */
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #ifdef VM
@@ -29,8 +30,17 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* 기본 우선순위. */
 #define PRI_MAX 63                      /* 최고 우선순위. */
 
+/* MLFQS nice 값. */
+#define NICE_MIN -20                    /* 가장 양보하지 않음. */
+#define NICE_DEFAULT 0                  /* 기본 nice. */
+#define NICE_MAX 20                     /* 가장 양보함. */
+
 #define FD_MAX 128
 
+struct cpu;
+struct spinlock;
+struct tlb_gather;
+
 /* 커널 스레드 또는 사용자 프로세스.
  *
  * 각 스레드 구조체는 자체 4KB 페이지에 저장됩니다.
@@ -89,16 +99,24 @@ struct thread {
 	tid_t tid;                          /* 스레드 식별자. */
 	enum thread_status status;          /* 스레드 상태. */
 	int exit_status;                    /* 스레드 종료 상태. */
+	struct cpu *cpu;                    /* 속한 CPU (threads/smp.h). */
 	char name[16];                      /* 이름 (디버깅 목적). */
-	int64_t sleep_until; // 깨어날 틱
 
 	int priority; // 이것은 계속 바뀔 수 있음
 	int default_priority; // 원래 가졌던 우선순위
 
 	struct lock *waiting_lock; // 내가 대기 중인 락
+	struct rwlock_hold *waiting_hold; // 내가 rwlock을 기다리는 hold
+	struct list rwlock_holds; // 잡고 있는 rwlock의 hold (max_priority 내림차순)
+	struct list rwlock_spares; // 다 쓴 hold, 다음 rwlock에 다시 쓴다
+
+	int nice; // MLFQS nice 값
+	fixed_t recent_cpu; // MLFQS 최근 CPU 사용량
+	int64_t recent_cpu_epoch; // recent_cpu가 반영된 마지막 초
+
+	int64_t last_ran; // 마지막으로 CPU를 내려놓은 틱 (캐시 친화성 힌트)
 
-	struct list donation_list; // 기부를 받은 목록
-	struct list_elem donation_elem; // 기부 목록 안의 요소
+	struct list held_locks; // 잡고 있는 락 (max_priority 내림차순)
 
 	struct list child_list; // 자식 스레드 목록
 	struct child_info *self_ci;
@@ -115,10 +133,13 @@ struct thread {
 #ifdef USERPROG
 	/* userprog/process.c에서 소유. */
 	uint64_t *pml4;                     /* 페이지 맵 레벨 4 */	
+	struct tlb_gather *tlb_gather;      /* 모으고 있는 TLB 무효화 (threads/mmu.h). */
 #endif
 #ifdef VM
 	/* 스레드가 소유한 전체 가상 메모리를 위한 테이블. */
 	struct supplemental_page_table spt;
+	uint64_t user_rsp;                  /* 시스템 호출 진입 시의 사용자 rsp. */
+	int64_t vtime;                      /* 실행한 틱 수, WSClock의 가상 시간. */
 #endif
 
 	/* thread.c에서 소유. */
@@ -144,6 +165,9 @@ struct child_info * find_child_info(struct thread *parent, tid_t child_tid);
 
 void thread_init (void);
 void thread_start (void);
+void thread_init_cpu (struct cpu *);
+void thread_init_ap (struct cpu *);
+void thread_start_ap (void) NO_RETURN;
 
 void thread_tick (void);
 void thread_print_stats (void);
@@ -152,10 +176,10 @@ typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
+void thread_block_unlock (struct spinlock *);
 void thread_unblock (struct thread *);
 
 void thread_sleep (int64_t ticks);
-void thread_wake (int64_t ticks);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -173,10 +197,8 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-bool thread_sleep_compare (const struct list_elem *a, const struct list_elem *b, void *aux);
 bool thread_priority_compare (const struct list_elem *a, const struct list_elem *b, void *aux);
 void thread_update_priority (struct thread *t);
-void thread_remove_donations (struct thread *t, struct lock *lock);
 void thread_donate_priority (struct thread *t);
 
 void do_iret (struct intr_frame *tf);
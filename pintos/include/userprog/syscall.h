@@ -1,9 +1,8 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
-extern struct lock filesys_lock;
-
 void syscall_init (void);
+void syscall_init_ap (void);
 
 void syscall_exit (int);
 
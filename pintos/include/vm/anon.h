@@ -5,9 +5,13 @@ struct page;
 enum vm_type;
 
 struct anon_page {
+	size_t slot;                 /* Swap slot, or BITMAP_ERROR if none. */
 };
 
 void vm_anon_init (void);
+void anon_print_stats (void);
+void anon_swap_flush (void);
+void anon_share (struct page *dst, struct page *src);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
 
 #endif
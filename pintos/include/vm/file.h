@@ -1,17 +1,52 @@
 #ifndef VM_FILE_H
 #define VM_FILE_H
+#include <list.h>
 #include "filesys/file.h"
 #include "vm/vm.h"
 
 struct page;
 enum vm_type;
+struct supplemental_page_table;
+
+/* Where a lazily loaded page gets its contents: READ_BYTES bytes of
+ * INODE starting at OFS, followed by zeroes up to the end of the page.
+ * A segment holds its own reference to INODE.  It is the only kind of
+ * aux data passed to vm_alloc_page_with_initializer(), so uninit pages
+ * know how to copy and free it. */
+struct file_segment {
+	struct inode *inode;
+	off_t ofs;
+	size_t read_bytes;
+};
 
 struct file_page {
+	struct file_segment seg;     /* Where the page lives in its file. */
+};
+
+/* A mapping made by one mmap() call. */
+struct mmap_region {
+	void *addr;                  /* First page. */
+	size_t page_cnt;             /* Number of pages. */
+	struct file *file;           /* Own handle, from file_reopen(). */
+	struct list_elem elem;       /* Element in the SPT's MMAPS. */
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+void file_share (struct page *dst, struct page *src);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+void mmap_region_free (struct supplemental_page_table *,
+		struct mmap_region *);
+bool mmap_regions_copy (struct list *dst, struct list *src);
+bool file_lazy_load (struct page *, void *aux);
+
+struct file_segment *file_segment_create (struct file *, off_t ofs,
+		size_t read_bytes);
+struct file_segment *file_segment_dup (const struct file_segment *);
+void file_segment_free (struct file_segment *);
+bool file_segment_load (const struct file_segment *, void *kva);
+bool file_segment_is_cached (const struct file_segment *);
+void file_segment_prefetch (const struct file_segment *);
 #endif
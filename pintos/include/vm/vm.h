@@ -1,6 +1,7 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -27,9 +28,7 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
-#ifdef EFILESYS
 #include "filesys/page_cache.h"
-#endif
 
 struct page_operations;
 struct thread;
@@ -46,6 +45,11 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;   /* Element in the owner's SPT. */
+	struct list_elem frame_elem; /* Element in the frame's PAGES. */
+	uint64_t *pml4;              /* Address space VA is mapped in. */
+	struct thread *owner;        /* Process whose SPT holds it, or NULL. */
+	bool writable;               /* May user code write to VA? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -53,16 +57,24 @@ struct page {
 		struct uninit_page uninit;
 		struct anon_page anon;
 		struct file_page file;
-#ifdef EFILESYS
 		struct page_cache page_cache;
-#endif
 	};
 };
 
 /* The representation of "frame" */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;           /* First of PAGES, or NULL. */
+	struct list pages;           /* Pages mapping this frame. */
+	unsigned ref_cnt;            /* Number of PAGES; >1 means copy-on-write. */
+	struct list_elem elem;       /* Element in the frame table. */
+	int pin_cnt;                 /* Must not be evicted while nonzero. */
+	bool huge;                   /* Maybe mapped as part of a huge page. */
+
+	/* Replacement state. */
+	bool active;                 /* On the active list, not the inactive? */
+	bool referenced;             /* Seen used once while inactive? */
+	int64_t last_use;            /* Owner's virtual time when last seen used. */
 };
 
 /* The function table for page operations.
@@ -85,8 +97,25 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct hash pages;           /* Pages keyed by page-aligned VA. */
+	void *stack_bottom;          /* Lowest page of the user stack. */
+	struct list mmaps;           /* struct mmap_region, one per mmap(). */
 };
 
+/* -stack=SIZE: most bytes the user stack may grow to. */
+extern size_t vm_stack_limit;
+
+/* -evict=POLICY: how vm_get_victim() chooses frames to evict. */
+enum evict_policy {
+	EVICT_FIFO,                  /* Oldest frame first. */
+	EVICT_CLOCK,                 /* Second-chance clock. */
+	EVICT_WSCLOCK,               /* WSClock with an inactive list. */
+};
+extern enum evict_policy vm_evict_policy;
+
+/* -huge: map aligned 2 MB anonymous regions with huge pages. */
+extern bool vm_huge_pages;
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -98,6 +127,7 @@ bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -106,6 +136,11 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
+void vm_free_frame (struct page *page);
+bool vm_pin_page (struct page *page);
+bool vm_pin_resident (struct page *page);
+bool vm_pin_dirty (struct page *page);
+void vm_unpin_page (struct page *page);
 bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
 
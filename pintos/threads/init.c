@@ -20,6 +20,7 @@
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -56,6 +57,10 @@ static void paging_init (uint64_t mem_end);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+#ifdef VM
+static size_t parse_size (const char *);
+static enum evict_policy parse_evict_policy (const char *);
+#endif
 static void run_actions (char **argv);
 static void usage (void);
 
@@ -105,6 +110,7 @@ main (void) {
 	thread_start ();
 	serial_init_queue ();
 	timer_calibrate ();
+	smp_init ();
 
 #ifdef FILESYS
 	/* Initialize file system. */
@@ -155,6 +161,17 @@ paging_init (uint64_t mem_end) {
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		// Each aligned 2 MB that is all below mem_end and clear of the
+		// read-only kernel text gets one huge page.
+		if (pa % HPGSIZE == 0 && pa + HPGSIZE <= mem_end
+				&& (va + HPGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) &_end_kernel_text)) {
+			if ((pte = pml4e_walk_pde (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_P | PTE_W | PTE_PS;
+			pa += HPGSIZE - PGSIZE;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
@@ -165,6 +182,7 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_init_cpu ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -221,6 +239,16 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-smp"))
+			smp_requested_cpus = atoi (value);
+#ifdef VM
+		else if (!strcmp (name, "-stack"))
+			vm_stack_limit = parse_size (value);
+		else if (!strcmp (name, "-evict"))
+			vm_evict_policy = parse_evict_policy (value);
+		else if (!strcmp (name, "-huge"))
+			vm_huge_pages = true;
+#endif
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
@@ -234,6 +262,39 @@ parse_options (char **argv) {
 	return argv;
 }
 
+#ifdef VM
+/* Parses VALUE, a byte count with an optional K, M or G suffix. */
+static size_t
+parse_size (const char *value) {
+	size_t size = atoi (value);
+
+	switch (value[strlen (value) - 1]) {
+		case 'G': case 'g':
+			size <<= 10;
+			/* Fall through. */
+		case 'M': case 'm':
+			size <<= 10;
+			/* Fall through. */
+		case 'K': case 'k':
+			size <<= 10;
+	}
+	return size;
+}
+
+/* Parses VALUE, the name of a frame eviction policy. */
+static enum evict_policy
+parse_evict_policy (const char *value) {
+	if (!strcmp (value, "fifo"))
+		return EVICT_FIFO;
+	else if (!strcmp (value, "clock"))
+		return EVICT_CLOCK;
+	else if (!strcmp (value, "wsclock"))
+		return EVICT_WSCLOCK;
+	else
+		PANIC ("unknown eviction policy \"%s\" (use -h for help)", value);
+}
+#endif
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv) {
@@ -326,8 +387,14 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -smp=N             Run on N CPUs (default 1).\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -stack=SIZE        Let user stacks grow to SIZE bytes (K/M/G).\n"
+			"  -evict=POLICY      Evict frames by fifo, clock or wsclock (default).\n"
+			"  -huge              Map aligned 2 MB anonymous regions with huge pages.\n"
 #endif
 			);
 	power_off ();
@@ -354,12 +421,17 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	pml4_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	filesys_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
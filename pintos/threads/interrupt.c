@@ -6,9 +6,11 @@
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
@@ -99,9 +101,14 @@ static const char *intr_names[INTR_CNT];
    pre-empted.  Handlers for external interrupts also may not
    sleep, although they may invoke intr_yield_on_return() to
    request that a new process be scheduled just before the
-   interrupt returns. */
-static bool in_external_intr;   /* Are we processing an external interrupt? */
-static bool yield_on_return;    /* Should we yield on interrupt return? */
+   interrupt returns.
+
+   Vectors 0x20...0x2f come from the 8259 PICs and 0x30...0x3f
+   from the local APIC.  Whether we are processing an external
+   interrupt, and whether to yield on its return, is tracked per
+   CPU in struct cpu. */
+#define INTR_EXT_FIRST 0x20
+#define INTR_EXT_LAST 0x3f
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -173,13 +180,7 @@ intr_init (void) {
 		intr_names[i] = "unknown";
 	}
 
-#ifdef USERPROG
-	/* Load TSS. */
-	ltr (SEL_TSS);
-#endif
-
-	/* Load IDT register. */
-	lidt(&idt_desc);
+	intr_init_ap ();
 
 	/* Initialize intr_names. */
 	intr_names[0] = "#DE Divide Error";
@@ -203,6 +204,19 @@ intr_init (void) {
 	intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Loads the task register and the IDT on the running CPU.
+   Application processors share the IDT that intr_init() built. */
+void
+intr_init_ap (void) {
+#ifdef USERPROG
+	/* Load TSS. */
+	ltr (SEL_TSS);
+#endif
+
+	/* Load IDT register. */
+	lidt(&idt_desc);
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -227,7 +241,7 @@ register_handler (uint8_t vec_no, int dpl, enum intr_level level,
 void
 intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
 		const char *name) {
-	ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+	ASSERT (vec_no >= INTR_EXT_FIRST && vec_no <= INTR_EXT_LAST);
 	register_handler (vec_no, 0, INTR_OFF, handler, name);
 }
 
@@ -248,7 +262,7 @@ void
 intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
 		intr_handler_func *handler, const char *name)
 {
-	ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+	ASSERT (vec_no < INTR_EXT_FIRST || vec_no > INTR_EXT_LAST);
 	register_handler (vec_no, dpl, level, handler, name);
 }
 
@@ -256,6 +270,11 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
    and false at all other times. */
 bool
 intr_context (void) {
+	/* Keep the thread on this CPU while we look. */
+	enum intr_level old_level = intr_disable ();
+	bool in_external_intr = this_cpu ()->in_external_intr;
+	intr_set_level (old_level);
+
 	return in_external_intr;
 }
 
@@ -266,7 +285,7 @@ intr_context (void) {
 void
 intr_yield_on_return (void) {
 	ASSERT (intr_context ());
-	yield_on_return = true;
+	this_cpu ()->yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -332,18 +351,21 @@ void
 intr_handler (struct intr_frame *frame) {
 	bool external;
 	intr_handler_func *handler;
+	struct cpu *cpu = NULL;
 
 	/* External interrupts are special.
 	   We only handle one at a time (so interrupts must be off)
 	   and they need to be acknowledged on the PIC (see below).
 	   An external interrupt handler cannot sleep. */
-	external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+	external = frame->vec_no >= INTR_EXT_FIRST
+		&& frame->vec_no <= INTR_EXT_LAST;
 	if (external) {
 		ASSERT (intr_get_level () == INTR_OFF);
 		ASSERT (!intr_context ());
 
-		in_external_intr = true;
-		yield_on_return = false;
+		cpu = this_cpu ();
+		cpu->in_external_intr = true;
+		cpu->yield_on_return = false;
 	}
 
 	/* Invoke the interrupt's handler. */
@@ -366,10 +388,13 @@ intr_handler (struct intr_frame *frame) {
 		ASSERT (intr_get_level () == INTR_OFF);
 		ASSERT (intr_context ());
 
-		in_external_intr = false;
-		pic_end_of_interrupt (frame->vec_no);
+		cpu->in_external_intr = false;
+		if (frame->vec_no < LAPIC_TIMER_VEC)
+			pic_end_of_interrupt (frame->vec_no);
+		else
+			lapic_eoi ();
 
-		if (yield_on_return)
+		if (cpu->yield_on_return)
 			thread_yield ();
 	}
 }
@@ -1,18 +1,230 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdio.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
+#include "devices/lapic.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers.
+ *
+ * With CR4.PCIDE set, TLB entries are tagged with the PCID in the
+ * low 12 bits of CR3, and a CR3 load with CR3_NOFLUSH set keeps the
+ * entries of every PCID, so a process switched back in finds its
+ * translations still cached.  Each CPU has PCID_SLOTS PCIDs, 1 to
+ * PCID_SLOTS, and remembers which pml4 owns each in PCID_OWNER.
+ * Switching to a pml4 that owns a slot loads its PCID without a
+ * flush.  Otherwise the next slot in round-robin order is taken
+ * from its owner and loaded with a flush, which is all a CPU without
+ * PCIDs ever does.  PCID 0 belongs to base_pml4, whose user half is
+ * empty, so it never needs flushing.
+ *
+ * Stale entries are what a no-flush load has to fear.  Changing a
+ * PTE in a way that could leave one invalidates the page on the
+ * running CPU if the pml4 is loaded there, and takes the pml4 out of
+ * every other slot it owns, so that the next switch to it on those
+ * CPUs flushes.  A CPU that is running the pml4 right now, as
+ * recorded in CPU_PML4, is sent a shootdown IPI and invalidates the
+ * page itself. */
+#define PCID_SLOTS 8
+#define CR3_NOFLUSH (1ULL << 63)
+#define CR4_PCIDE (1ULL << 17)
+#define CPUID_ECX_PCID (1U << 17)
+
+static bool pcid_enabled;
+static uint64_t *pcid_owner[NCPU_MAX][PCID_SLOTS];
+static unsigned pcid_next[NCPU_MAX];
+
+static long long cr3_skip_cnt;   /* Switches to the pml4 already loaded. */
+static long long pcid_hit_cnt;   /* ...to a pml4 with its PCID kept. */
+static long long pcid_miss_cnt;  /* ...that had to take a PCID and flush. */
+
+/* Pages a range may span before reloading CR3 to flush it costs
+ * less than an invlpg on each. */
+#define TLB_FLUSH_CEILING 32
+
+static uint64_t *cpu_pml4[NCPU_MAX];     /* pml4 loaded on each CPU. */
+
+/* The shootdown being sent, one at a time, and how many of the
+ * CPUs it went to have yet to carry it out. */
+static struct lock shootdown_lock;
+static struct tlb_range shootdown_range;
+static int shootdown_pending;
+
+static long long tlb_page_cnt;   /* Pages invalidated one by one. */
+static long long tlb_full_cnt;   /* Ranges flushed by a CR3 reload. */
+static long long shootdown_cnt;  /* Shootdown IPIs sent. */
+
+/* Returns true if PML4 is the one loaded on the running CPU. */
+static bool
+pml4_is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Takes PML4 out of every CPU's PCID slots, except the running
+ * CPU's if PML4 is loaded there.  Must be called with interrupts
+ * off, so that the running CPU cannot change. */
+static void
+pcid_forget (uint64_t *pml4) {
+	int self = pml4_is_active (pml4) ? this_cpu ()->id : -1;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	/* Alone, and running PML4: no other CPU to scan. */
+	if (cpu_cnt == 1 && self == 0)
+		return;
+	for (int cpu = 0; cpu < cpu_cnt; cpu++) {
+		if (cpu == self)
+			continue;
+		for (int i = 0; i < PCID_SLOTS; i++)
+			if (__atomic_load_n (&pcid_owner[cpu][i], __ATOMIC_RELAXED) == pml4)
+				__atomic_store_n (&pcid_owner[cpu][i], NULL, __ATOMIC_RELEASE);
+	}
+}
+
+/* Invalidates the pages in R on the running CPU, which must have
+ * R's pml4 loaded, one by one or, if there are many, all at once. */
+static void
+tlb_flush_local (const struct tlb_range *r) {
+	uint64_t va;
+
+	if ((r->end - r->start) / PGSIZE <= TLB_FLUSH_CEILING) {
+		for (va = r->start; va < r->end; va += PGSIZE)
+			invlpg (va);
+		__atomic_add_fetch (&tlb_page_cnt, (r->end - r->start) / PGSIZE,
+				__ATOMIC_RELAXED);
+	} else {
+		/* Without CR3_NOFLUSH, reloading CR3 flushes its PCID. */
+		lcr3 (rcr3 ());
+		__atomic_add_fetch (&tlb_full_cnt, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* Has the CPUs in TARGETS, a bitmap of cpus[] indexes, carry out
+ * R, and waits until they all have. */
+static void
+tlb_shootdown (const struct tlb_range *r, uint32_t targets) {
+	int cpu, cnt = 0;
+
+	ASSERT (!intr_context ());
+
+	lock_acquire (&shootdown_lock);
+	shootdown_range = *r;
+	for (cpu = 0; cpu < cpu_cnt; cpu++)
+		if (targets & (1u << cpu))
+			cnt++;
+	__atomic_store_n (&shootdown_pending, cnt, __ATOMIC_RELEASE);
+	for (cpu = 0; cpu < cpu_cnt; cpu++)
+		if (targets & (1u << cpu))
+			lapic_send_ipi (cpus[cpu].lapic_id, LAPIC_TLB_VEC);
+	while (__atomic_load_n (&shootdown_pending, __ATOMIC_ACQUIRE) != 0)
+		cpu_relax ();
+	shootdown_cnt += cnt;
+	lock_release (&shootdown_lock);
+}
+
+/* Makes sure no CPU goes on using a translation for a page in R
+ * from before a change to its PTE. */
+static void
+tlb_flush_range (const struct tlb_range *r) {
+	enum intr_level old_level = intr_disable ();
+	int self = this_cpu ()->id;
+	uint32_t targets = 0;
+
+	if (pml4_is_active (r->pml4))
+		tlb_flush_local (r);
+	if (pcid_enabled)
+		pcid_forget (r->pml4);
+
+	/* Pairs with pml4_activate(): a CPU switching to the pml4 either
+	 * finds its PCID forgotten or is seen running it here. */
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	for (int cpu = 0; cpu < cpu_cnt; cpu++)
+		if (cpu != self
+				&& __atomic_load_n (&cpu_pml4[cpu], __ATOMIC_RELAXED) == r->pml4)
+			targets |= 1u << cpu;
+	intr_set_level (old_level);
+
+	if (targets != 0)
+		tlb_shootdown (r, targets);
+}
+
+/* Makes sure no CPU goes on using a translation for VA in PML4
+ * from before a change to its PTE. */
+static void
+pml4_invalidate (uint64_t *pml4, uint64_t va) {
+	struct tlb_range r = { pml4, va, va + PGSIZE };
+
+	tlb_flush_range (&r);
+}
+
+/* Invalidates everything TLB has gathered. */
+static void
+tlb_gather_flush (struct tlb_gather *tlb) {
+	for (size_t i = 0; i < tlb->cnt; i++)
+		tlb_flush_range (&tlb->ranges[i]);
+	tlb->cnt = 0;
+}
+
+#ifdef USERPROG
+/* Adds range ADD to TLB, flushing it first if it tracks as many
+ * other address spaces as it can. */
+static void
+tlb_gather_add (struct tlb_gather *tlb, const struct tlb_range *add) {
+	struct tlb_range *r;
+	size_t i;
+
+	for (i = 0; i < tlb->cnt; i++)
+		if (tlb->ranges[i].pml4 == add->pml4)
+			break;
+	if (i == tlb->cnt) {
+		if (tlb->cnt == TLB_GATHER_SPACES)
+			tlb_gather_flush (tlb);
+		tlb->ranges[tlb->cnt++] = *add;
+		return;
+	}
+	r = &tlb->ranges[i];
+	if (add->start < r->start)
+		r->start = add->start;
+	if (add->end > r->end)
+		r->end = add->end;
+}
+#endif
+
+/* Replaces the huge page that *PDE maps with a page table of 4 kB
+ * pages that map the same memory with the same flags, so that part
+ * of it can be changed on its own.  The caller must flush the huge
+ * page's translation; see pml4e_walk_split().
+ * Returns false if no page table could be allocated. */
+static bool
+pde_split (uint64_t *pde) {
+	uint64_t *pt = palloc_get_page (0);
+	uint64_t pa = PTE_ADDR (*pde);
+	uint64_t flags = *pde & PTE_FLAGS & ~(uint64_t) PTE_PS;
+
+	if (pt == NULL)
+		return false;
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	return true;
+}
+
+/* If a huge page maps VA, its PDE stands in for VA's PTE, unless
+ * CREATE asks for a PTE of VA's own, which there is none of. */
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if (((uint64_t) pte & PTE_P) && ((uint64_t) pte & PTE_PS))
+			return create ? NULL : &pdp[idx];
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -60,7 +272,10 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR lies in a huge page, the address of its page directory
+ * entry is returned instead when CREATE is false, and a null pointer
+ * when CREATE is true; pml4e_walk_split() splits the huge page. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +303,61 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, which maps a huge page, points to a page
+ * table, or is empty.  If the tables above it are missing, behavior
+ * depends on CREATE as for pml4e_walk(). */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create) {
+	const unsigned idx[] = { PML4 (va), PDPE (va) };
+	uint64_t *table = pml4;
+
+	for (unsigned level = 0; level < 2; level++) {
+		uint64_t *entry = &table[idx[level]];
+		if (!(*entry & PTE_P)) {
+			uint64_t *new_page;
+			if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+				return NULL;
+			*entry = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		table = ptov (PTE_ADDR (*entry));
+	}
+	return &table[PDX (va)];
+}
+
+/* Like pml4e_walk (PML4, VA, false), but if VA lies in a huge page,
+ * splits it first, so that the PTE returned maps VA's page alone.
+ * Returns a null pointer, leaving the huge page as it was, if there
+ * is no memory for the split. */
+static uint64_t *
+pml4e_walk_split (uint64_t *pml4, const uint64_t va) {
+	uint64_t *pte = pml4e_walk (pml4, va, false);
+
+	if (pte != NULL && is_huge_pte (pte)) {
+		uint64_t base = va & ~(uint64_t) HPGMASK;
+		struct tlb_range r = { pml4, base, base + HPGSIZE };
+		uint64_t *pt;
+		uint64_t stale;
+
+		if (!pde_split (pte))
+			return NULL;
+
+		/* Until the huge page's translation is shot down, a CPU using
+		 * it sets accessed and dirty bits in what is now the page
+		 * table's PDE.  Once it is, hand any it set on to the pages. */
+		tlb_flush_range (&r);
+		pt = ptov (PTE_ADDR (*pte));
+		stale = *pte & (PTE_A | PTE_D);
+		if (stale != 0) {
+			for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+				pt[i] |= stale;
+			*pte &= ~stale;
+		}
+		pte = &pt[PTX (va)];
+	}
+	return pte;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,10 +392,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				/* FUNC gets the PDE of a huge page. */
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -143,7 +421,9 @@ pdp_for_each (uint64_t *pdp,
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * A huge page is passed once, as its PDE and the address of its
+ * first byte; see is_huge_pte(). */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -169,7 +449,9 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		/* A huge page's frames belong to the frame table, which
+		 * frees them with their pages, so only its PDE goes. */
+		if ((((uint64_t) pte) & PTE_P) && !(pdp[i] & PTE_PS))
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -192,6 +474,13 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
+	/* A new pml4 at the same address must not inherit its PCIDs. */
+	if (pcid_enabled) {
+		enum intr_level old_level = intr_disable ();
+		pcid_forget (pml4);
+		intr_set_level (old_level);
+	}
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
@@ -199,11 +488,132 @@ pml4_destroy (uint64_t *pml4) {
 	palloc_free_page ((void *) pml4);
 }
 
+/* Turns on PCIDs on the running CPU, if the bootstrap processor,
+ * which calls this first, has them. */
+void
+pml4_init_cpu (void) {
+	static bool checked;
+
+	if (!checked) {
+		uint32_t eax = 1, ebx, ecx, edx;
+
+		asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+		pcid_enabled = (ecx & CPUID_ECX_PCID) != 0;
+		lock_init (&shootdown_lock);
+		checked = true;
+	}
+	if (pcid_enabled) {
+		/* CR4.PCIDE may only be set while the PCID in CR3 is 0. */
+		ASSERT ((rcr3 () & PTE_FLAGS) == 0);
+		lcr4 (rcr4 () | CR4_PCIDE);
+	}
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register, unless it is loaded already.  With PCIDs, PML4 keeps
+ * its cached translations if it still owns a PCID on this CPU. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	uint64_t cr3 = vtop (pml4 ? pml4 : base_pml4);
+	enum intr_level old_level = intr_disable ();
+
+	/* Seen by tlb_flush_range() before the PCID slots are checked. */
+	__atomic_store_n (&cpu_pml4[this_cpu ()->id], pml4, __ATOMIC_SEQ_CST);
+	if (!pcid_enabled) {
+		if (PTE_ADDR (rcr3 ()) != cr3)
+			lcr3 (cr3);
+		else
+			__atomic_add_fetch (&cr3_skip_cnt, 1, __ATOMIC_RELAXED);
+	} else if (pml4 == NULL || pml4 == base_pml4) {
+		if (PTE_ADDR (rcr3 ()) != cr3)
+			lcr3 (cr3 | CR3_NOFLUSH);
+		else
+			__atomic_add_fetch (&cr3_skip_cnt, 1, __ATOMIC_RELAXED);
+	} else {
+		int cpu = this_cpu ()->id;
+		int i;
+
+		for (i = 0; i < PCID_SLOTS; i++)
+			if (__atomic_load_n (&pcid_owner[cpu][i], __ATOMIC_ACQUIRE) == pml4)
+				break;
+		if (i < PCID_SLOTS) {
+			if (rcr3 () != (cr3 | (i + 1))) {
+				lcr3 (cr3 | (i + 1) | CR3_NOFLUSH);
+				__atomic_add_fetch (&pcid_hit_cnt, 1, __ATOMIC_RELAXED);
+			} else
+				__atomic_add_fetch (&cr3_skip_cnt, 1, __ATOMIC_RELAXED);
+		} else {
+			/* Out of PCIDs, or PML4 was forgotten: take over the next
+			 * slot and flush what its last owner left behind. */
+			i = pcid_next[cpu]++ % PCID_SLOTS;
+			__atomic_store_n (&pcid_owner[cpu][i], pml4, __ATOMIC_RELAXED);
+			lcr3 (cr3 | (i + 1));
+			__atomic_add_fetch (&pcid_miss_cnt, 1, __ATOMIC_RELAXED);
+		}
+	}
+	intr_set_level (old_level);
+}
+
+/* Flushes every cached translation of PML4: at once on the CPUs
+ * running it, and on the others at their next switch to it. */
+void
+pml4_flush (uint64_t *pml4) {
+	struct tlb_range r = { pml4, 0, KERN_BASE };
+
+	tlb_flush_range (&r);
+}
+
+/* Starts gathering the TLB invalidations that pml4_clear_page()
+ * owes into TLB.  Inside another gather, the outer one gathers them
+ * instead. */
+void
+tlb_gather_begin (struct tlb_gather *tlb) {
+	tlb->cnt = 0;
+#ifdef USERPROG
+	struct thread *t = thread_current ();
+
+	if (t->tlb_gather == NULL)
+		t->tlb_gather = tlb;
+#endif
+}
+
+/* Carries out every invalidation gathered since tlb_gather_begin(),
+ * including the outer gather's if TLB is nested in one, and stops
+ * gathering into TLB. */
+void
+tlb_gather_end (struct tlb_gather *tlb) {
+#ifdef USERPROG
+	struct thread *t = thread_current ();
+	struct tlb_gather *outer = t->tlb_gather;
+
+	if (outer == tlb)
+		t->tlb_gather = NULL;
+	if (outer != NULL)
+		tlb_gather_flush (outer);
+#else
+	tlb_gather_flush (tlb);
+#endif
+}
+
+/* Carries out the shootdown being sent, on the CPU it was sent to.
+ * A CPU that has switched away from its pml4 since has nothing
+ * left to flush. */
+void
+tlb_shootdown_interrupt (void) {
+	if (pml4_is_active (shootdown_range.pml4))
+		tlb_flush_local (&shootdown_range);
+	__atomic_sub_fetch (&shootdown_pending, 1, __ATOMIC_RELEASE);
+}
+
+/* Prints address space switching statistics. */
+void
+pml4_print_stats (void) {
+	printf ("TLB: PCIDs %s, %lld CR3 loads skipped, "
+			"%lld PCID hits, %lld PCID misses\n",
+			pcid_enabled ? "on" : "off", cr3_skip_cnt, pcid_hit_cnt,
+			pcid_miss_cnt);
+	printf ("TLB: %lld pages invalidated, %lld ranges flushed whole, "
+			"%lld shootdowns\n", tlb_page_cnt, tlb_full_cnt, shootdown_cnt);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,8 +626,11 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (is_huge_pte (pte))
+			return ptov (PTE_ADDR (*pte)) + ((uint64_t) uaddr & HPGMASK);
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -243,29 +656,122 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	return pte != NULL;
 }
 
+/* Maps the 2 MB of user virtual memory at UPAGE to the 2 MB of
+ * physically contiguous memory at kernel virtual address KPAGE with
+ * a single huge page, read/write if RW.  Both must be aligned to
+ * HPGSIZE, and no page in the range may be mapped already; a page
+ * table left empty by earlier mappings is freed.
+ * Returns true if successful, false if memory allocation failed
+ * or part of the range is mapped. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	uint64_t *pde;
+
+	ASSERT (((uint64_t) upage & HPGMASK) == 0);
+	ASSERT ((vtop (kpage) & HPGMASK) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	pde = pml4e_walk_pde (pml4, (uint64_t) upage, 1);
+	if (pde == NULL)
+		return false;
+	if (*pde & PTE_P) {
+		uint64_t *pt = ptov (PTE_ADDR (*pde));
+
+		if (is_huge_pte (pde))
+			return false;
+		for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+			if (pt[i] & PTE_P)
+				return false;
+		*pde = 0;
+		palloc_free_page (pt);
+	}
+	*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+
+	/* Drop any cached pointer to the old page table. */
+	pml4_invalidate (pml4, (uint64_t) upage);
+	return true;
+}
+
+/* If a huge page maps user virtual page UPAGE in PML4, splits it
+ * into 4 kB pages, so that UPAGE's PTE can then be changed without
+ * touching the rest.  The translations stay the same.
+ * Returns false if there is no memory for the split. */
+bool
+pml4_split_huge_page (uint64_t *pml4, void *upage) {
+	uint64_t *pte;
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	return pte == NULL || !is_huge_pte (pte)
+		|| pml4e_walk_split (pml4, (uint64_t) upage) != NULL;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
+ * UPAGE need not be mapped.  If it is part of a huge page, the
+ * huge page is split and the rest stays mapped, or, if there is no
+ * memory for the split, the whole huge page is unmapped; a caller
+ * that must keep the rest mapped splits it first with
+ * pml4_split_huge_page().  Inside a TLB gather, stale translations
+ * may linger until tlb_gather_end(). */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
+	struct tlb_range r = { pml4, (uint64_t) upage,
+		(uint64_t) upage + PGSIZE };
 	uint64_t *pte;
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
-	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	pte = pml4e_walk_split (pml4, (uint64_t) upage);
+	if (pte == NULL) {
+		pte = pml4e_walk (pml4, (uint64_t) upage, false);
+		r.start = (uint64_t) upage & ~(uint64_t) HPGMASK;
+		r.end = r.start + HPGSIZE;
+	}
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+#ifdef USERPROG
+		if (thread_current ()->tlb_gather != NULL) {
+			tlb_gather_add (thread_current ()->tlb_gather, &r);
+			return;
+		}
+#endif
+		tlb_flush_range (&r);
+	}
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for user virtual
+ * page UPAGE in PML4.  Other bits, including dirty and accessed,
+ * are preserved.  UPAGE need not be mapped.  If it is part of a
+ * huge page, the huge page is split first, and nothing changes if
+ * there is no memory for that. */
+void
+pml4_set_writable (uint64_t *pml4, void *upage, bool writable) {
+	uint64_t *pte;
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pte = pml4e_walk_split (pml4, (uint64_t) upage);
+	if (pte != NULL) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		pml4_invalidate (pml4, (uint64_t) upage);
 	}
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
- * Returns false if PML4 contains no PTE for VPAGE. */
+ * Returns false if PML4 contains no PTE for VPAGE.
+ * In a huge page, a write to any of its pages makes all of them
+ * dirty. */
 bool
 pml4_is_dirty (uint64_t *pml4, const void *vpage) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
@@ -273,25 +779,29 @@ pml4_is_dirty (uint64_t *pml4, const void *vpage) {
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
- * in PML4. */
+ * in PML4.  Cleaning a page that is part of a huge page splits the
+ * huge page, so that writes to the others are not forgotten; if
+ * there is no memory for that, the page is left dirty. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = dirty ? pml4e_walk (pml4, (uint64_t) vpage, false)
+		: pml4e_walk_split (pml4, (uint64_t) vpage);
 	if (pte) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
-			*pte &= ~(uint32_t) PTE_D;
+			*pte &= ~(uint64_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_invalidate (pml4, (uint64_t) vpage);
 	}
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 has been
  * accessed recently, that is, between the time the PTE was
  * installed and the last time it was cleared.  Returns false if
- * PML4 contains no PTE for VPAGE. */
+ * PML4 contains no PTE for VPAGE.  The pages of a huge page share
+ * one accessed bit until pml4_set_accessed() clears it for one of
+ * them. */
 bool
 pml4_is_accessed (uint64_t *pml4, const void *vpage) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
@@ -299,17 +809,23 @@ pml4_is_accessed (uint64_t *pml4, const void *vpage) {
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  Clearing it for a page that is part of a huge page
+   splits the huge page, so that the others still look used; if
+   there is no memory for that, the page still looks used too. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t *pte = accessed ? pml4e_walk (pml4, (uint64_t) vpage, false)
+		: pml4e_walk_split (pml4, (uint64_t) vpage);
 	if (pte) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
-			*pte &= ~(uint32_t) PTE_A;
+			*pte &= ~(uint64_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
+		/* A stale entry elsewhere only keeps the page from looking
+		 * used again until it is flushed, which is not worth
+		 * costing that CPU its cached translations. */
+		if (pml4_is_active (pml4))
 			invlpg ((uint64_t) vpage);
 	}
 }
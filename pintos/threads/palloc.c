@@ -284,6 +284,40 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Like palloc_get_multiple(), but the pages start at a multiple of
+   ALIGN_CNT pages, in physical as well as kernel virtual memory.
+   ALIGN_CNT must be a power of 2. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt,
+		size_t align_cnt) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t base_no = pg_no (pool->base);
+	size_t page_idx = ROUND_UP (base_no, align_cnt) - base_no;
+	void *pages = NULL;
+
+	ASSERT (align_cnt > 0 && (align_cnt & (align_cnt - 1)) == 0);
+
+	lock_acquire (&pool->lock);
+	for (; page_idx + page_cnt <= bitmap_size (pool->used_map);
+			page_idx += align_cnt)
+		if (bitmap_none (pool->used_map, page_idx, page_cnt)) {
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+			pages = pool->base + PGSIZE * page_idx;
+			break;
+		}
+	lock_release (&pool->lock);
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset (pages, 0, PGSIZE * page_cnt);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+
+	return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -0,0 +1,143 @@
+#include "threads/smp.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/ioapic.h"
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/syscall.h"
+#include "userprog/tss.h"
+#endif
+
+/* CPU별 상태. cpus[0]은 부팅 CPU(BSP)입니다. */
+struct cpu cpus[NCPU_MAX];
+int cpu_cnt = 1;
+
+/* -smp=N: 부팅할 CPU 수. */
+int smp_requested_cpus = 1;
+
+/* 지금 부팅 중인 AP. ap_main()이 자신의 struct cpu를 찾는 데 씁니다. */
+static struct cpu *volatile ap_booting;
+
+/* threads/start.S의 AP 시작 코드. */
+extern char ap_trampoline[], ap_trampoline_end[];
+extern char ap_tramp_stack[];
+
+void ap_main (void) NO_RETURN;
+static bool smp_start_ap (struct cpu *);
+
+/* -smp=N으로 둘 이상의 CPU를 요청했으면 응용 프로세서(AP)를
+   깨웁니다. 인터럽트가 켜진 상태에서 timer_calibrate() 이후에
+   호출해야 합니다.
+
+   장치 인터럽트는 여전히 8259 PIC를 거쳐 BSP로만 들어오고,
+   8254 타이머도 BSP에서만 돕니다. AP는 Local APIC 타이머로
+   자신의 타임 슬라이스를 셉니다. */
+void
+smp_init (void) {
+	enum intr_level old_level;
+	int id;
+
+	ASSERT (intr_get_level () == INTR_ON);
+
+	if (smp_requested_cpus <= 1)
+		return;
+	if (!lapic_present ()) {
+		printf ("SMP: no local APIC, using 1 CPU.\n");
+		return;
+	}
+	if (smp_requested_cpus > NCPU_MAX)
+		smp_requested_cpus = NCPU_MAX;
+
+	old_level = intr_disable ();
+	lapic_init (true);
+	cpus[0].lapic_id = lapic_id ();
+	intr_set_level (old_level);
+	ioapic_init ();
+	lapic_timer_calibrate ();
+
+	memcpy (ptov (AP_TRAMPOLINE), ap_trampoline,
+			ap_trampoline_end - ap_trampoline);
+
+	for (id = 1; id < smp_requested_cpus; id++) {
+		struct cpu *cpu = &cpus[id];
+
+		cpu->id = id;
+		/* QEMU는 Local APIC ID를 0부터 차례로 매깁니다. */
+		cpu->lapic_id = id;
+		cpu_cnt = id + 1;
+		if (!smp_start_ap (cpu)) {
+			printf ("SMP: CPU %d did not start.\n", id);
+			cpu_cnt = id;
+			break;
+		}
+	}
+	printf ("SMP: %d CPUs online.\n", cpu_cnt);
+}
+
+/* CPU를 깨우고 스케줄러를 돌리기 시작할 때까지 최대 1초 기다립니다.
+   성공하면 true를 반환합니다. */
+static bool
+smp_start_ap (struct cpu *cpu) {
+	uint64_t *tramp_stack =
+		ptov (AP_TRAMPOLINE + (ap_tramp_stack - ap_trampoline));
+	void *stack;
+	int64_t start;
+
+	/* AP의 부팅 스택 페이지는 그대로 idle 스레드가 됩니다. */
+	stack = palloc_get_page (PAL_ZERO);
+	if (stack == NULL)
+		return false;
+#ifdef USERPROG
+	/* idle 스레드는 잠들 수 없으므로 TSS는 미리 할당해 둡니다. */
+	cpu->tss = palloc_get_page (PAL_ZERO);
+	if (cpu->tss == NULL) {
+		palloc_free_page (stack);
+		return false;
+	}
+#endif
+	thread_init_cpu (cpu);
+
+	ap_booting = cpu;
+	*tramp_stack = (uint64_t) stack + PGSIZE;
+	if (!lapic_start_ap (cpu->lapic_id, AP_TRAMPOLINE))
+		return false;
+
+	start = timer_ticks ();
+	while (!cpu->started && timer_elapsed (start) < TIMER_FREQ)
+		timer_sleep (1);
+	return cpu->started;
+}
+
+/* AP의 C 진입점. start.S의 시작 코드가 부트 페이지 테이블과
+   smp_start_ap()이 준비한 스택 위에서 인터럽트가 꺼진 채로 호출합니다. */
+void
+ap_main (void) {
+	struct cpu *cpu = ap_booting;
+
+	thread_init_ap (cpu);
+	lcr3 (vtop (base_pml4));
+	pml4_init_cpu ();
+#ifdef USERPROG
+	tss_init ();
+	gdt_init ();
+	syscall_init_ap ();
+#endif
+	intr_init_ap ();
+	lapic_init (false);
+	lapic_timer_start ();
+
+	cpu->started = true;
+	thread_start_ap ();
+}
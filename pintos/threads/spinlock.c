@@ -0,0 +1,59 @@
+#include "threads/spinlock.h"
+#include <debug.h>
+#include <stddef.h>
+#include "threads/interrupt.h"
+#include "threads/smp.h"
+#include "intrinsic.h"
+
+/* LOCK을 NAME이라는 이름으로 초기화합니다. */
+void
+spinlock_init (struct spinlock *lock, const char *name) {
+	ASSERT (lock != NULL);
+
+	lock->locked = 0;
+	lock->cpu = NULL;
+	lock->name = name;
+}
+
+/* LOCK을 획득할 때까지 돈다. 인터럽트가 꺼져 있어야 합니다.
+   같은 CPU에서 다시 잡으면 교착 상태이므로 어설션으로 잡아냅니다. */
+void
+spin_lock (struct spinlock *lock) {
+	ASSERT (lock != NULL);
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (!spin_holding (lock));
+
+	while (__atomic_exchange_n (&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+		/* 캐시 라인을 두드리지 않도록 읽기만 하며 기다립니다. */
+		while (lock->locked)
+			cpu_relax ();
+	}
+	lock->cpu = this_cpu ();
+}
+
+/* LOCK을 한 번만 시도합니다. 획득했으면 true를 반환합니다. */
+bool
+spin_trylock (struct spinlock *lock) {
+	ASSERT (lock != NULL);
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (__atomic_exchange_n (&lock->locked, 1, __ATOMIC_ACQUIRE))
+		return false;
+	lock->cpu = this_cpu ();
+	return true;
+}
+
+/* LOCK을 해제합니다. */
+void
+spin_unlock (struct spinlock *lock) {
+	ASSERT (spin_holding (lock));
+
+	lock->cpu = NULL;
+	__atomic_store_n (&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+/* 현재 CPU가 LOCK을 잡고 있으면 true를 반환합니다. */
+bool
+spin_holding (const struct spinlock *lock) {
+	return lock->locked && lock->cpu == this_cpu ();
+}
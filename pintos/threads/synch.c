@@ -29,8 +29,15 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/spinlock.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
+
+/* 우선순위 기부 상태를 보호한다. 실행 큐 락보다 먼저 잡는다. */
+struct spinlock donation_lock = SPINLOCK_INITIALIZER ("donation");
 
 /* SEMA를 VALUE로 초기화한다. 세마포어는 음이 아닌 정수 값과
 	 이를 조작하는 두 개의 원자적 연산을 가진다.
@@ -46,6 +53,7 @@ sema_init (struct semaphore *sema, unsigned value) {
 
 	sema->value = value;
 	list_init (&sema->waiters);
+	spinlock_init (&sema->lock, "semaphore");
 }
 
 /* 세마포어에 대한 Down 또는 "P" 연산이다. SEMA의 값이 양수가
@@ -63,11 +71,15 @@ sema_down (struct semaphore *sema) {
 	ASSERT (!intr_context ());
 
 	old_level = intr_disable ();
+	spin_lock (&sema->lock);
 	while (sema->value == 0) {
 		list_insert_ordered (&sema->waiters, &thread_current ()->elem, thread_priority_compare, NULL);
-		thread_block ();
+		// 잠든 뒤에 세마포어 락을 놓아야 다른 CPU의 sema_up과 엇갈리지 않는다
+		thread_block_unlock (&sema->lock);
+		spin_lock (&sema->lock);
 	}
 	sema->value--;
+	spin_unlock (&sema->lock);
 	intr_set_level (old_level);
 }
 
@@ -84,6 +96,7 @@ sema_try_down (struct semaphore *sema) {
 	ASSERT (sema != NULL);
 
 	old_level = intr_disable ();
+	spin_lock (&sema->lock);
 	if (sema->value > 0)
 	{
 		sema->value--;
@@ -91,6 +104,7 @@ sema_try_down (struct semaphore *sema) {
 	}
 	else
 		success = false;
+	spin_unlock (&sema->lock);
 	intr_set_level (old_level);
 
 	return success;
@@ -105,6 +119,7 @@ sema_up (struct semaphore *sema) {
 	enum intr_level old_level;
 	ASSERT (sema != NULL);
 	old_level = intr_disable ();
+	spin_lock (&sema->lock);
 
 	if (!list_empty (&sema->waiters)) {
 		// down에서 ordered를 해서 이거 안해도 될 줄 았았다.. 그래서 엄청 해맸다..
@@ -113,6 +128,7 @@ sema_up (struct semaphore *sema) {
 	}
 
 	sema->value++;
+	spin_unlock (&sema->lock);
 	thread_preempt();
 	intr_set_level (old_level);
 }
@@ -168,6 +184,27 @@ lock_init (struct lock *lock) {
 
 	lock->holder = NULL;
 	sema_init (&lock->semaphore, 1);
+	lock->max_priority = PRI_MIN - 1;
+}
+
+/* 현재 스레드를 LOCK의 소유자로 기록한다. 대기 목록의 맨 앞이
+	 가장 높은 우선순위이므로 max_priority를 곧바로 다시 계산할 수 있다.
+	 donation_lock과 세마포어 락을 잡고 있어야 한다. */
+static void
+lock_set_holder (struct lock *lock) {
+	struct thread *curr = thread_current ();
+	struct list *waiters = &lock->semaphore.waiters;
+
+	ASSERT (spin_holding (&donation_lock));
+	ASSERT (spin_holding (&lock->semaphore.lock));
+
+	curr->waiting_lock = NULL;
+	lock->holder = curr;
+	lock->max_priority = list_empty (waiters) ? PRI_MIN - 1
+		: list_entry (list_front (waiters), struct thread, elem)->priority;
+	list_insert_ordered (&curr->held_locks, &lock->elem, lock_priority_compare, NULL);
+	if (!thread_mlfqs)
+		thread_update_priority (curr);
 }
 
 /* LOCK을 획득한다. 필요하면 사용 가능해질 때까지 잠긴다. 현재
@@ -183,21 +220,32 @@ lock_acquire (struct lock *lock) {
 	ASSERT (!intr_context ());
 	ASSERT (!lock_held_by_current_thread (lock));
 
-	// 모시.. 락소유자가 NULL타라
-	if (lock->holder != NULL) {
-		enum intr_level old_level = intr_disable ();
-		struct thread *curr = thread_current ();
-		curr->waiting_lock = lock;
+	struct thread *curr = thread_current ();
+	struct semaphore *sema = &lock->semaphore;
+	enum intr_level old_level;
 
-		// 뒤로 붙혀서 순서대로 탐색할게?
-		list_push_back (&lock->holder->donation_list, &curr->donation_elem);
-		thread_donate_priority (curr);
-		intr_set_level (old_level);
+	// 줄 서기와 기부를 donation_lock 안에서 함께 해야 새 소유자가
+	// max_priority를 계산할 때 대기자를 빠뜨리지 않는다
+	old_level = intr_disable ();
+	spin_lock (&donation_lock);
+	spin_lock (&sema->lock);
+	while (sema->value == 0) {
+		list_insert_ordered (&sema->waiters, &curr->elem, thread_priority_compare, NULL);
+		curr->waiting_lock = lock;
+		// MLFQS에서는 우선순위 기부를 하지 않는다
+		if (!thread_mlfqs)
+			thread_donate_priority (curr);
+		spin_unlock (&donation_lock);
+		thread_block_unlock (&sema->lock);
+
+		spin_lock (&donation_lock);
+		spin_lock (&sema->lock);
 	}
-
-	sema_down (&lock->semaphore);
-	thread_current ()->waiting_lock = NULL;
-	lock->holder = thread_current ();
+	sema->value--;
+	lock_set_holder (lock);
+	spin_unlock (&sema->lock);
+	spin_unlock (&donation_lock);
+	intr_set_level (old_level);
 }
 
 /* LOCK을 획득하려 시도하고 성공하면 true, 실패하면 false를 반환
@@ -207,20 +255,34 @@ lock_acquire (struct lock *lock) {
 	 있다. */
 bool
 lock_try_acquire (struct lock *lock) {
+	struct semaphore *sema = &lock->semaphore;
+	enum intr_level old_level;
 	bool success;
 
 	ASSERT (lock != NULL);
 	ASSERT (!lock_held_by_current_thread (lock));
 
-	success = sema_try_down (&lock->semaphore);
-	if (success)
-		lock->holder = thread_current ();
+	old_level = intr_disable ();
+	spin_lock (&donation_lock);
+	spin_lock (&sema->lock);
+	success = sema->value > 0;
+	if (success) {
+		sema->value--;
+		lock_set_holder (lock);
+	}
+	spin_unlock (&sema->lock);
+	spin_unlock (&donation_lock);
+	intr_set_level (old_level);
+
 	return success;
 }
 
 /* LOCK을 해제한다. LOCK은 반드시 현재 스레드가 소유하고 있어야
 	 한다. (lock_release 함수)
 
+	 대기 목록은 우선순위 순서로 유지되므로 맨 앞 스레드만 깨우면
+	 되고, 기부받은 우선순위도 held_locks의 맨 앞에서 바로 구한다.
+
 	 인터럽트 핸들러는 락을 획득할 수 없으므로, 인터럽트 핸들러
 	 내에서 락을 해제하려는 시도는 의미가 없다. */
 // 라꾸 카이죠!!! 
@@ -229,17 +291,27 @@ lock_release (struct lock *lock) {
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
 
+	struct semaphore *sema = &lock->semaphore;
 	enum intr_level old_level = intr_disable ();
 
+	spin_lock (&donation_lock);
 	// 헤제 했으니 도네 삭제
-	thread_remove_donations (thread_current (), lock);
-	// 삭제했으면 읍데이트
-	thread_update_priority (thread_current ());
+	list_remove (&lock->elem);
 	// 이거 아까 얘기함..
 	lock->holder = NULL;
+	// 삭제했으면 읍데이트
+	if (!thread_mlfqs)
+		thread_update_priority (thread_current ());
+
+	spin_lock (&sema->lock);
+	if (!list_empty (&sema->waiters))
+		thread_unblock (list_entry (list_pop_front (&sema->waiters), struct thread, elem));
+	sema->value++;
+	spin_unlock (&sema->lock);
+	spin_unlock (&donation_lock);
 
+	thread_preempt ();
 	intr_set_level (old_level);
-	sema_up (&lock->semaphore);
 }
 
 /* 현재 스레드가 LOCK을 소유하고 있으면 true, 그렇지 않으면 false를
@@ -252,6 +324,487 @@ lock_held_by_current_thread (const struct lock *lock) {
 	return lock->holder == thread_current ();
 }
 
+/* 두 락의 max_priority를 비교한다. held_locks를 내림차순으로 유지한다. */
+bool
+lock_priority_compare (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
+	const struct lock *la = list_entry (a, struct lock, elem);
+	const struct lock *lb = list_entry (b, struct lock, elem);
+
+	return la->max_priority > lb->max_priority;
+}
+
+/* 적응형 뮤텍스가 잠들기 전에 도는 최대 횟수. 대략 수 마이크로초로,
+	 짧은 임계 구역 하나를 기다리기에 충분하고 문맥 전환보다 싸다. */
+#define MUTEX_SPIN_LIMIT 1000
+
+/* MUTEX를 초기화한다. */
+void
+mutex_init (struct mutex *mutex) {
+	ASSERT (mutex != NULL);
+
+	lock_init (&mutex->lock);
+	mutex->acquisitions = 0;
+	mutex->contended = 0;
+	mutex->spins = 0;
+	mutex->blocks = 0;
+	mutex->block_ticks = 0;
+}
+
+/* MUTEX의 소유자가 다른 CPU에서 실행 중이어서 곧 풀릴 것 같으면
+	 true를 반환한다. 소유자가 없으면 넘겨지는 중이므로 역시 true다.
+	 락 없이 읽으므로 틀릴 수 있지만, 틀려도 조금 더 돌거나 일찍
+	 잠들 뿐이다. 해제된 스레드 페이지도 커널 주소 공간에 그대로
+	 매핑되어 있어서 읽어도 안전하다. */
+static bool
+mutex_owner_running (const struct mutex *mutex) {
+	struct thread *holder = mutex->lock.holder;
+
+	if (holder == NULL)
+		return true;
+	return holder->status == THREAD_RUNNING
+		&& holder->cpu != thread_current ()->cpu;
+}
+
+/* MUTEX를 획득한다. 소유자가 다른 CPU에서 돌고 있는 동안에는
+	 MUTEX_SPIN_LIMIT번까지 돌며 기다리고, 그래도 안 되면 lock_acquire()로
+	 잠든다. 도는 동안에는 기부하지 않지만, 소유자가 실행 중이므로
+	 우선순위 역전이 생기지 않는다.
+
+	 lock_acquire()와 마찬가지로 인터럽트 핸들러에서 호출하면 안 된다. */
+void
+mutex_acquire (struct mutex *mutex) {
+	long long spins = 0;
+	bool acquired, contended;
+
+	ASSERT (mutex != NULL);
+	ASSERT (!intr_context ());
+
+	acquired = lock_try_acquire (&mutex->lock);
+	contended = !acquired;
+	if (contended) {
+		while (spins < MUTEX_SPIN_LIMIT && mutex_owner_running (mutex)) {
+			cpu_relax ();
+			spins++;
+			// 비어 보일 때만 시도해서 캐시 라인을 덜 흔든다
+			if (mutex->lock.holder == NULL
+					&& lock_try_acquire (&mutex->lock)) {
+				acquired = true;
+				break;
+			}
+		}
+	}
+
+	if (!acquired) {
+		int64_t start = timer_ticks ();
+
+		lock_acquire (&mutex->lock);
+		mutex->blocks++;
+		mutex->block_ticks += timer_elapsed (start);
+	}
+
+	mutex->acquisitions++;
+	if (contended)
+		mutex->contended++;
+	mutex->spins += spins;
+}
+
+/* MUTEX를 돌거나 잠들지 않고 한 번만 시도한다. */
+bool
+mutex_try_acquire (struct mutex *mutex) {
+	ASSERT (mutex != NULL);
+
+	if (!lock_try_acquire (&mutex->lock))
+		return false;
+	mutex->acquisitions++;
+	return true;
+}
+
+/* MUTEX를 해제한다. 현재 스레드가 소유하고 있어야 한다. */
+void
+mutex_release (struct mutex *mutex) {
+	ASSERT (mutex != NULL);
+
+	lock_release (&mutex->lock);
+}
+
+/* 현재 스레드가 MUTEX를 소유하고 있으면 true를 반환한다. */
+bool
+mutex_held_by_current_thread (const struct mutex *mutex) {
+	ASSERT (mutex != NULL);
+
+	return lock_held_by_current_thread (&mutex->lock);
+}
+
+/* NAME이라는 이름으로 MUTEX의 경합 통계를 출력한다. */
+void
+mutex_print_stats (const struct mutex *mutex, const char *name) {
+	printf ("Mutex %s: %lld acquisitions, %lld contended, %lld spins, "
+			"%lld blocks, %lld ticks blocked\n",
+			name, mutex->acquisitions, mutex->contended, mutex->spins,
+			mutex->blocks, (long long) mutex->block_ticks);
+}
+
+/* RWLOCK을 초기화한다. 여러 읽기 스레드가 함께 소유하거나 하나의
+	 쓰기 스레드가 혼자 소유할 수 있다. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	rw->readers = 0;
+	rw->writer = NULL;
+	rw->max_priority = PRI_MIN - 1;
+	list_init (&rw->holds);
+	list_init (&rw->read_waiters);
+	list_init (&rw->write_waiters);
+}
+
+/* 현재 스레드가 RW를 쓰기 모드(WRITE)로 잡는 데 쓸 hold를 만든다.
+	 반납해 둔 hold가 있으면 다시 쓰므로, 보통은 할당하지 않는다.
+	 잠들 수 있으므로 donation_lock을 잡기 전에 불러야 한다. */
+static struct rwlock_hold *
+rwlock_hold_get (struct rwlock *rw, bool write) {
+	struct thread *curr = thread_current ();
+	struct rwlock_hold *hold;
+
+	if (!list_empty (&curr->rwlock_spares))
+		hold = list_entry (list_pop_front (&curr->rwlock_spares), struct rwlock_hold, elem);
+	else {
+		hold = malloc (sizeof *hold);
+		if (hold == NULL)
+			PANIC ("out of memory for rwlock hold");
+	}
+	hold->rwlock = rw;
+	hold->thread = curr;
+	hold->write = write;
+	return hold;
+}
+
+/* 현재 스레드의 다 쓴 HOLD를 반납한다. */
+static void
+rwlock_hold_put (struct rwlock_hold *hold) {
+	list_push_front (&thread_current ()->rwlock_spares, &hold->elem);
+}
+
+/* 현재 스레드가 반납해 둔 hold를 모두 해제한다. 스레드가 끝날 때
+	 부르며, 그 뒤로는 rwlock을 잡으면 안 된다. */
+void
+rwlock_free_spares (void) {
+	struct list *spares = &thread_current ()->rwlock_spares;
+
+	while (!list_empty (spares))
+		free (list_entry (list_pop_front (spares), struct rwlock_hold, elem));
+}
+
+/* T의 rwlock_holds에서 RW에 대한 hold를 찾는다. 없으면 NULL을
+	 반환한다. 한 스레드가 동시에 잡는 rwlock은 몇 개뿐이다. */
+static struct rwlock_hold *
+rwlock_find_hold (struct thread *t, const struct rwlock *rw) {
+	struct list_elem *e;
+
+	for (e = list_begin (&t->rwlock_holds); e != list_end (&t->rwlock_holds);
+			e = list_next (e)) {
+		struct rwlock_hold *hold = list_entry (e, struct rwlock_hold, thread_elem);
+
+		if (hold->rwlock == rw)
+			return hold;
+	}
+	return NULL;
+}
+
+/* HOLD의 스레드가 HOLD의 rwlock을 소유하게 한다. donation_lock을
+	 잡고 있어야 한다. */
+static void
+rwlock_add_hold (struct rwlock_hold *hold) {
+	struct rwlock *rw = hold->rwlock;
+
+	ASSERT (spin_holding (&donation_lock));
+
+	if (hold->write)
+		rw->writer = hold->thread;
+	else
+		rw->readers++;
+	list_push_back (&rw->holds, &hold->elem);
+	list_insert_ordered (&hold->thread->rwlock_holds, &hold->thread_elem,
+			rwlock_priority_compare, NULL);
+}
+
+/* HOLD를 그 rwlock과 스레드의 목록에서 뺀다. donation_lock을 잡고
+	 있어야 한다. */
+static void
+rwlock_remove_hold (struct rwlock_hold *hold) {
+	struct rwlock *rw = hold->rwlock;
+
+	ASSERT (spin_holding (&donation_lock));
+
+	if (hold->write)
+		rw->writer = NULL;
+	else
+		rw->readers--;
+	list_remove (&hold->elem);
+	list_remove (&hold->thread_elem);
+}
+
+/* 대기 목록의 맨 앞에서 RW의 max_priority를 다시 구한다. */
+static void
+rwlock_update_max_priority (struct rwlock *rw) {
+	struct list *waiters[] = { &rw->read_waiters, &rw->write_waiters };
+
+	rw->max_priority = PRI_MIN - 1;
+	for (int i = 0; i < 2; i++)
+		if (!list_empty (waiters[i])) {
+			struct rwlock_hold *hold = list_entry (list_front (waiters[i]), struct rwlock_hold, elem);
+
+			if (hold->thread->priority > rw->max_priority)
+				rw->max_priority = hold->thread->priority;
+		}
+}
+
+/* RW를 더 이상 아무도 소유하지 않으면 기다리는 스레드에게 넘긴다.
+	 쓰기 스레드가 기다리면 그 중 우선순위가 가장 높은 하나에게,
+	 아니면 기다리는 읽기 스레드 모두에게 넘긴다. 깨운 스레드가
+	 있으면 true를 반환한다. donation_lock을 잡고 있어야 한다. */
+static bool
+rwlock_hand_off (struct rwlock *rw) {
+	ASSERT (spin_holding (&donation_lock));
+
+	if (rw->writer != NULL || rw->readers > 0)
+		return false;
+
+	if (!list_empty (&rw->write_waiters)) {
+		struct rwlock_hold *hold = list_entry (list_pop_front (&rw->write_waiters), struct rwlock_hold, elem);
+		struct thread *t = hold->thread;
+
+		// 새 소유자가 남은 대기자의 기부를 받도록 먼저 다시 계산
+		rwlock_update_max_priority (rw);
+		t->waiting_hold = NULL;
+		rwlock_add_hold (hold);
+		if (!thread_mlfqs)
+			thread_update_priority (t);
+		thread_unblock (t);
+		return true;
+	}
+
+	if (list_empty (&rw->read_waiters))
+		return false;
+	rw->max_priority = PRI_MIN - 1;
+	while (!list_empty (&rw->read_waiters)) {
+		struct rwlock_hold *hold = list_entry (list_pop_front (&rw->read_waiters), struct rwlock_hold, elem);
+
+		hold->thread->waiting_hold = NULL;
+		rwlock_add_hold (hold);
+		thread_unblock (hold->thread);
+	}
+	return true;
+}
+
+/* 현재 스레드가 HOLD로 WAITERS에 줄 서서 RW를 넘겨받을 때까지
+	 잠든다. donation_lock을 잡고 인터럽트를 끈 채로 호출해야 하며,
+	 돌아올 때도 donation_lock을 잡고 있다. */
+static void
+rwlock_wait (struct rwlock_hold *hold, struct list *waiters) {
+	struct thread *curr = thread_current ();
+
+	curr->waiting_hold = hold;
+	list_insert_ordered (waiters, &hold->elem, rwlock_waiter_compare, NULL);
+	if (!thread_mlfqs)
+		thread_donate_priority (curr);
+
+	// rwlock_hand_off()가 waiting_hold를 지우며 소유권을 넘겨준다
+	while (curr->waiting_hold != NULL) {
+		thread_block_unlock (&donation_lock);
+		spin_lock (&donation_lock);
+	}
+}
+
+/* RW를 읽기 모드로 획득한다. 쓰기 스레드가 소유하고 있거나
+	 기다리고 있으면 넘겨받을 때까지 잠든다.
+
+	 이 함수는 잠들 수 있으므로 인터럽트 핸들러 내에서 호출하면
+	 안 된다. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	struct rwlock_hold *hold;
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (!rwlock_read_held_by_current_thread (rw));
+	ASSERT (!rwlock_write_held_by_current_thread (rw));
+
+	hold = rwlock_hold_get (rw, false);
+	old_level = intr_disable ();
+	spin_lock (&donation_lock);
+	// 쓰기 스레드가 기다리면 뒤에 줄 서서 쓰기가 굶지 않게 한다
+	if (rw->writer == NULL && list_empty (&rw->write_waiters))
+		rwlock_add_hold (hold);
+	else
+		rwlock_wait (hold, &rw->read_waiters);
+	spin_unlock (&donation_lock);
+	intr_set_level (old_level);
+}
+
+/* RW를 읽기 모드로 잠들지 않고 획득하려 시도한다. 성공하면 true를
+	 반환한다. */
+bool
+rwlock_try_acquire_read (struct rwlock *rw) {
+	struct rwlock_hold *hold;
+	enum intr_level old_level;
+	bool success;
+
+	ASSERT (rw != NULL);
+	ASSERT (!rwlock_read_held_by_current_thread (rw));
+	ASSERT (!rwlock_write_held_by_current_thread (rw));
+
+	hold = rwlock_hold_get (rw, false);
+	old_level = intr_disable ();
+	spin_lock (&donation_lock);
+	success = rw->writer == NULL && list_empty (&rw->write_waiters);
+	if (success)
+		rwlock_add_hold (hold);
+	spin_unlock (&donation_lock);
+	intr_set_level (old_level);
+
+	if (!success)
+		rwlock_hold_put (hold);
+	return success;
+}
+
+/* 현재 스레드가 소유한 RW를 HOLD와 함께 내려놓고, 더 이상 아무도
+	 소유하지 않으면 기다리는 스레드에게 넘긴다. */
+static void
+rwlock_release (struct rwlock *rw) {
+	struct thread *curr = thread_current ();
+	struct rwlock_hold *hold;
+	enum intr_level old_level;
+	bool woke;
+
+	old_level = intr_disable ();
+	spin_lock (&donation_lock);
+	hold = rwlock_find_hold (curr, rw);
+	rwlock_remove_hold (hold);
+	woke = rwlock_hand_off (rw);
+	// 이 rwlock으로 받은 기부를 내려놓는다
+	if (!thread_mlfqs)
+		thread_update_priority (curr);
+	spin_unlock (&donation_lock);
+	rwlock_hold_put (hold);
+
+	if (woke)
+		thread_preempt ();
+	intr_set_level (old_level);
+}
+
+/* 현재 스레드가 읽기 모드로 소유한 RW를 해제한다. 마지막 읽기
+	 스레드였다면 기다리는 쓰기 스레드에게 넘긴다. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (rwlock_read_held_by_current_thread (rw));
+
+	rwlock_release (rw);
+}
+
+/* RW를 쓰기 모드로 획득한다. 다른 스레드가 어느 모드로든 소유하고
+	 있으면 넘겨받을 때까지 잠들며, 그동안 모든 소유자에게 우선순위를
+	 기부한다.
+
+	 이 함수는 잠들 수 있으므로 인터럽트 핸들러 내에서 호출하면
+	 안 된다. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	struct rwlock_hold *hold;
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (!rwlock_read_held_by_current_thread (rw));
+	ASSERT (!rwlock_write_held_by_current_thread (rw));
+
+	hold = rwlock_hold_get (rw, true);
+	old_level = intr_disable ();
+	spin_lock (&donation_lock);
+	if (rw->writer == NULL && rw->readers == 0)
+		rwlock_add_hold (hold);
+	else
+		rwlock_wait (hold, &rw->write_waiters);
+	spin_unlock (&donation_lock);
+	intr_set_level (old_level);
+}
+
+/* RW를 쓰기 모드로 잠들지 않고 획득하려 시도한다. 성공하면 true를
+	 반환한다. */
+bool
+rwlock_try_acquire_write (struct rwlock *rw) {
+	struct rwlock_hold *hold;
+	enum intr_level old_level;
+	bool success;
+
+	ASSERT (rw != NULL);
+	ASSERT (!rwlock_read_held_by_current_thread (rw));
+	ASSERT (!rwlock_write_held_by_current_thread (rw));
+
+	hold = rwlock_hold_get (rw, true);
+	old_level = intr_disable ();
+	spin_lock (&donation_lock);
+	success = rw->writer == NULL && rw->readers == 0;
+	if (success)
+		rwlock_add_hold (hold);
+	spin_unlock (&donation_lock);
+	intr_set_level (old_level);
+
+	if (!success)
+		rwlock_hold_put (hold);
+	return success;
+}
+
+/* 현재 스레드가 쓰기 모드로 소유한 RW를 해제하고 기다리는
+	 스레드에게 넘긴다. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (rwlock_write_held_by_current_thread (rw));
+
+	rwlock_release (rw);
+}
+
+/* 현재 스레드가 RW를 읽기 모드로 소유하고 있으면 true를 반환한다. */
+bool
+rwlock_read_held_by_current_thread (const struct rwlock *rw) {
+	struct thread *curr = thread_current ();
+
+	ASSERT (rw != NULL);
+
+	return rw->writer != curr && rwlock_find_hold (curr, rw) != NULL;
+}
+
+/* 현재 스레드가 RW를 쓰기 모드로 소유하고 있으면 true를 반환한다. */
+bool
+rwlock_write_held_by_current_thread (const struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	return rw->writer == thread_current ();
+}
+
+/* 두 hold의 rwlock의 max_priority를 비교한다. 스레드의 rwlock_holds를
+	 내림차순으로 유지한다. */
+bool
+rwlock_priority_compare (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
+	const struct rwlock_hold *ha = list_entry (a, struct rwlock_hold, thread_elem);
+	const struct rwlock_hold *hb = list_entry (b, struct rwlock_hold, thread_elem);
+
+	return ha->rwlock->max_priority > hb->rwlock->max_priority;
+}
+
+/* 기다리는 두 hold의 스레드 우선순위를 비교한다. rwlock의 대기
+	 목록을 내림차순으로 유지한다. */
+bool
+rwlock_waiter_compare (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
+	const struct rwlock_hold *ha = list_entry (a, struct rwlock_hold, elem);
+	const struct rwlock_hold *hb = list_entry (b, struct rwlock_hold, elem);
+
+	return ha->thread->priority > hb->thread->priority;
+}
+
 /* 리스트 안의 하나의 세마포어 요소. */
 struct semaphore_elem {
 	struct list_elem elem;              /* List element. */
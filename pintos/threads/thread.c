@@ -8,8 +8,12 @@
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
+#include "threads/spinlock.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
+#include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -25,33 +29,37 @@
 #define THREAD_BASIC 0xd42df210
 
 /* THREAD_READY 상태의 프로세스 목록, 즉
-   실행할 준비가 되었지만 실제로는 실행되지 않는 프로세스들. */
-static struct list ready_list;
+   실행할 준비가 되었지만 실제로는 실행되지 않는 프로세스들은
+   CPU마다 따로 둡니다 (struct cpu의 ready_queues).
+   우선순위마다 하나의 FIFO 큐를 두고, ready_mask의 비트 P가
+   켜져 있으면 ready_queues[P]가 비어 있지 않음을 뜻합니다.
+   따라서 가장 높은 우선순위의 스레드는 비트 검색 한 번으로 찾습니다.
 
-/* THREAD_BLOCKED 상태의 프로세스 목록, 즉
-   잠들어 있고 깨어나기를 기다리는 프로세스들. */
-static struct list sleep_list;
-
-/* Idle 스레드. */
-static struct thread *idle_thread;
+   idle 스레드, 파괴 요청, 타임 슬라이스와 통계도 CPU별입니다. */
 
 /* 초기 스레드, init.c:main()을 실행하는 스레드. */
 static struct thread *initial_thread;
 
-/* allocate_tid()에서 사용하는 락. */
-static struct lock tid_lock;
-
-/* 스레드 파괴 요청 */
-static struct list destruction_req;
-
-/* 통계. */
-static long long idle_ticks;    /* Idle 상태에서 보낸 타이머 틱 수. */
-static long long kernel_ticks;  /* 커널 스레드의 타이머 틱 수. */
-static long long user_ticks;    /* 사용자 프로그램의 타이머 틱 수. */
-
 /* 스케줄링. */
 #define TIME_SLICE 4            /* 각 스레드에 할당할 타이머 틱 수. */
-static unsigned thread_ticks;   /* 마지막 yield 이후의 타이머 틱 수. */
+
+/* 작업 훔치기.
+   할 일이 없는 CPU는 잠들기 전에 가장 바쁜 CPU의 가장 높은 우선순위
+   큐에서 절반을 가져옵니다. 방금까지 실행되던 스레드는 캐시가 아직
+   따뜻하므로 옮기지 않고, 허탕을 치면 잠시 쉬었다가 다시 봅니다. */
+#define STEAL_COOLDOWN 2        /* 훔치기에 실패한 뒤 쉬는 틱 수. */
+#define CACHE_HOT_TICKS 1       /* 이 틱 수 안에 실행된 스레드는 옮기지 않습니다. */
+
+/* MLFQS.
+   recent_cpu는 매초 모든 스레드에 대해 감쇠해야 하지만, 매번 모든
+   스레드를 훑는 대신 실행 중이거나 준비된 스레드만 즉시 갱신합니다.
+   잠든 스레드는 깨어날 때 그동안의 감쇠 계수를 decay_history에서
+   꺼내 한꺼번에 반영합니다 (mlfqs_catch_up()). */
+#define PRI_UPDATE_TICKS 4      /* 실행 중인 스레드의 우선순위 재계산 주기. */
+#define DECAY_HISTORY 256       /* 기억하는 감쇠 계수의 개수 (초). */
+static fixed_t load_avg;        /* 시스템 로드 평균. */
+static fixed_t decay_history[DECAY_HISTORY]; /* 초별 recent_cpu 감쇠 계수. */
+static int64_t decay_seconds;   /* 지금까지 적용된 감쇠 횟수. */
 
 /* false(기본값)이면 라운드 로빈 스케줄러를 사용합니다.
    true이면 다단계 피드백 큐 스케줄러를 사용합니다.
@@ -61,11 +69,25 @@ bool thread_mlfqs;
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
-static struct thread *next_thread_to_run (void);
+static void idle_loop (void) NO_RETURN;
+static struct thread *next_thread_to_run (struct cpu *);
 static void init_thread (struct thread *, const char *name, int priority);
 static void do_schedule(int status);
 static void schedule (void);
+static void schedule_tail (void);
 static tid_t allocate_tid (void);
+static struct cpu *thread_rq_lock (struct thread *);
+static struct cpu *thread_select_cpu (void);
+static bool thread_steal (struct cpu *);
+static int cpu_load (const struct cpu *);
+static void ready_queue_push (struct cpu *, struct thread *);
+static void ready_queue_remove (struct cpu *, struct thread *);
+static int ready_queue_max_priority (const struct cpu *);
+static void thread_set_effective_priority (struct thread *, int priority);
+static int mlfqs_priority (const struct thread *);
+static void mlfqs_catch_up (struct thread *);
+static void mlfqs_tick (struct cpu *, struct thread *);
+static void mlfqs_second (void);
 
 /* T가 유효한 스레드를 가리키는 것처럼 보이면 true를 반환합니다. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
@@ -82,6 +104,10 @@ static tid_t allocate_tid (void);
 // gdt는 thread_init 이후에 설정되므로,
 // 먼저 임시 gdt를 설정해야 합니다.
 static uint64_t gdt[3] = { 0, 0x00af9a000000ffff, 0x00cf92000000ffff };
+static struct desc_ptr gdt_ds = {
+	.size = sizeof (gdt) - 1,
+	.address = (uint64_t) gdt
+};
 
 struct child_info *
 find_child_info(struct thread *parent, tid_t child_tid) {
@@ -96,13 +122,6 @@ find_child_info(struct thread *parent, tid_t child_tid) {
     return NULL;
 }
 
-bool
-thread_sleep_compare (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-	const struct thread *ta = list_entry (a, struct thread, elem);
-	const struct thread *tb = list_entry (b, struct thread, elem);
-	return ta->sleep_until < tb->sleep_until;
-}
-
 bool
 thread_priority_compare (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
 	const struct thread *ta = list_entry (a, struct thread, elem);
@@ -110,62 +129,114 @@ thread_priority_compare (const struct list_elem *a, const struct list_elem *b, v
 	return ta->priority > tb->priority;
 }
 
-static bool
-thread_donation_priority_less (const struct list_elem *a,
-		const struct list_elem *b, void *aux UNUSED) {
-	const struct thread *ta = list_entry (a, struct thread, donation_elem);
-	const struct thread *tb = list_entry (b, struct thread, donation_elem);
-	return ta->priority < tb->priority;
-}
-
 // 스레드의 우선순위를 재갱신합니다
+// held_locks와 rwlock_holds는 max_priority 내림차순이라 맨 앞만 보면 됩니다
 void
 thread_update_priority (struct thread *t) {
 	ASSERT (t != NULL);
 
 	int max_priority = t->default_priority;
 
-	if (!list_empty (&t->donation_list)) {
-		struct list_elem *max_elem = list_max (&t->donation_list, thread_donation_priority_less, NULL);
-		struct thread *donor = list_entry (max_elem, struct thread, donation_elem);
+	if (!list_empty (&t->held_locks)) {
+		struct lock *lock = list_entry (list_front (&t->held_locks), struct lock, elem);
 
-		if (donor->priority > max_priority)
-			max_priority = donor->priority;
+		if (lock->max_priority > max_priority)
+			max_priority = lock->max_priority;
 	}
 
-	t->priority = max_priority;
-}
+	// 잡고 있는 rwlock을 기다리는 스레드들도 기부합니다
+	if (!list_empty (&t->rwlock_holds)) {
+		struct rwlock_hold *hold = list_entry (list_front (&t->rwlock_holds), struct rwlock_hold, thread_elem);
 
-// 특정 락과 관련된 우선순위 기부 제거
-void
-thread_remove_donations (struct thread *t, struct lock *lock) {
-	ASSERT (t != NULL);
+		if (hold->rwlock->max_priority > max_priority)
+			max_priority = hold->rwlock->max_priority;
+	}
 
-	struct list_elem *e = list_begin (&t->donation_list);
+	thread_set_effective_priority (t, max_priority);
+}
 
-	while (e != list_end (&t->donation_list)) {
-		struct thread *donor = list_entry (e, struct thread, donation_elem);
-		struct list_elem *next = list_next (e);
+// T가 LOCK을 기다리며 잠들어 있으면 대기 목록에서 제자리로 옮깁니다.
+// 락의 대기 목록은 우선순위 순서로 유지되어 lock_release()가 맨 앞만 깨웁니다.
+static void
+thread_requeue_waiter (struct thread *t, struct lock *lock) {
+	struct semaphore *sema = &lock->semaphore;
 
-		if (donor->waiting_lock == lock)
-			list_remove (e);
+	// 막 lock_acquire()에서 줄을 선 현재 스레드는 이미 제자리에 있고
+	// 세마포어 락도 잡고 있습니다
+	if (t == thread_current ())
+		return;
 
-		e = next;
+	spin_lock (&sema->lock);
+	// 줄 서기와 잠들기는 세마포어 락 안에서 함께 일어나므로,
+	// 잠들어 있다면 목록 안에 있습니다
+	if (t->status == THREAD_BLOCKED) {
+		list_remove (&t->elem);
+		list_insert_ordered (&sema->waiters, &t->elem, thread_priority_compare, NULL);
 	}
+	spin_unlock (&sema->lock);
 }
 
 // 우선순위 기부를 수행합니다!
+// T의 우선순위가 올랐을 때 T가 기다리는 락을 따라 위로 전달합니다.
+// 홉마다 락 하나만 갱신하고, 더 이상 오르지 않으면 멈추므로 O(깊이)입니다.
 void
 thread_donate_priority (struct thread *t) {
-	// 락을 계속 위로 전달해야 합니다..
-	while (t->waiting_lock != NULL) {
-		struct thread *holder = t->waiting_lock->holder;
+	ASSERT (spin_holding (&donation_lock));
 
-		if (holder == NULL)
+	// 락을 계속 위로 전달해야 합니다..
+	for (;;) {
+		struct thread *holder;
+		int old_priority;
+
+		if (t->waiting_lock != NULL) {
+			struct lock *lock = t->waiting_lock;
+
+			thread_requeue_waiter (t, lock);
+			if (t->priority <= lock->max_priority)
+				break;
+			lock->max_priority = t->priority;
+
+			holder = lock->holder;
+			if (holder == NULL)
+				break;
+			// 소유자의 held_locks 순서를 맞춥니다
+			list_remove (&lock->elem);
+			list_insert_ordered (&holder->held_locks, &lock->elem, lock_priority_compare, NULL);
+		} else if (t->waiting_hold != NULL) {
+			struct rwlock_hold *hold = t->waiting_hold;
+			struct rwlock *rw = hold->rwlock;
+			struct list_elem *e;
+
+			list_remove (&hold->elem);
+			list_insert_ordered (hold->write ? &rw->write_waiters : &rw->read_waiters,
+					&hold->elem, rwlock_waiter_compare, NULL);
+			if (t->priority <= rw->max_priority)
+				break;
+			rw->max_priority = t->priority;
+
+			// 소유자는 여럿일 수 있으니 각자에게서 사슬을 따로 이어갑니다.
+			// 교착 상태가 아니면 대기 관계에 순환이 없으므로 끝납니다.
+			for (e = list_begin (&rw->holds); e != list_end (&rw->holds);
+					e = list_next (e)) {
+				struct rwlock_hold *h = list_entry (e, struct rwlock_hold, elem);
+
+				holder = h->thread;
+				list_remove (&h->thread_elem);
+				list_insert_ordered (&holder->rwlock_holds, &h->thread_elem, rwlock_priority_compare, NULL);
+				old_priority = holder->priority;
+				thread_update_priority (holder);
+				if (holder->priority != old_priority)
+					thread_donate_priority (holder);
+			}
+			break;
+		} else
 			break;
 
 		// 우선순위를 갱신합니다!
+		old_priority = holder->priority;
 		thread_update_priority (holder);
+		if (holder->priority == old_priority)
+			break;
 		t = holder;
 	}
 }
@@ -187,23 +258,61 @@ thread_init (void) {
 	/* 커널을 위한 임시 gdt를 다시 로드합니다
 	 * 이 gdt는 사용자 컨텍스트를 포함하지 않습니다.
 	 * 커널은 gdt_init()에서 사용자 컨텍스트를 포함하여 gdt를 재구축합니다. */
-	struct desc_ptr gdt_ds = {
-		.size = sizeof (gdt) - 1,
-		.address = (uint64_t) gdt
-	};
 	lgdt (&gdt_ds);
 
-	/* 전역 스레드 컨텍스트 초기화 */
-	lock_init (&tid_lock);
-	list_init (&ready_list);
-	list_init (&sleep_list);
-	list_init (&destruction_req);
+	/* 부팅 CPU의 스레드 컨텍스트 초기화 */
+	struct cpu *bsp = &cpus[0];
+	thread_init_cpu (bsp);
 
 	/* 실행 중인 스레드를 위한 스레드 구조체를 설정합니다. */
 	initial_thread = running_thread ();
 	init_thread (initial_thread, "main", PRI_DEFAULT);
+	initial_thread->cpu = bsp;
 	initial_thread->status = THREAD_RUNNING;
 	initial_thread->tid = allocate_tid ();
+	bsp->curr = initial_thread;
+	bsp->started = true;
+}
+
+/* CPU의 실행 큐와 스케줄러 상태를 초기화합니다.
+   CPU가 스레드를 실행하기 전에 한 번 호출되어야 합니다. */
+void
+thread_init_cpu (struct cpu *cpu) {
+	spinlock_init (&cpu->rq_lock, "run queue");
+	for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+		list_init (&cpu->ready_queues[pri]);
+	cpu->ready_mask = 0;
+	cpu->ready_count = 0;
+	cpu->curr = cpu->idle_thread = NULL;
+	list_init (&cpu->destruction_req);
+	cpu->thread_ticks = 0;
+}
+
+/* 응용 프로세서(AP)에서 호출되어, 부팅에 쓴 스택 페이지를 CPU의
+   idle 스레드로 만듭니다. 인터럽트는 꺼져 있어야 합니다.
+   thread_init()과 마찬가지로 이 함수가 끝나기 전에는
+   thread_current()를 호출하면 안 됩니다. */
+void
+thread_init_ap (struct cpu *cpu) {
+	struct thread *t = running_thread ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	lgdt (&gdt_ds);
+
+	init_thread (t, "idle", PRI_MIN);
+	t->cpu = cpu;
+	t->status = THREAD_RUNNING;
+	t->tid = allocate_tid ();
+	cpu->curr = cpu->idle_thread = t;
+}
+
+/* AP의 스케줄링을 시작합니다. 현재 스레드는 이 CPU의 idle 스레드가
+   되어 준비된 스레드가 없을 때만 실행됩니다. */
+void
+thread_start_ap (void) {
+	ASSERT (thread_current () == this_cpu ()->idle_thread);
+	idle_loop ();
 }
 
 /* 인터럽트를 활성화하여 선점형 스레드 스케줄링을 시작합니다.
@@ -226,28 +335,47 @@ thread_start (void) {
    따라서 이 함수는 외부 인터럽트 컨텍스트에서 실행됩니다. */
 void
 thread_tick (void) {
+	struct cpu *cpu = this_cpu ();
 	struct thread *t = thread_current ();
 
 	/* 통계를 업데이트합니다. */
-	if (t == idle_thread)
-		idle_ticks++;
+	if (t == cpu->idle_thread)
+		cpu->idle_ticks++;
 #ifdef USERPROG
-	else if (t->pml4 != NULL)
-		user_ticks++;
+	else if (t->pml4 != NULL) {
+		cpu->user_ticks++;
+#ifdef VM
+		t->vtime++;
+#endif
+	}
 #endif
 	else
-		kernel_ticks++;
+		cpu->kernel_ticks++;
+
+	if (thread_mlfqs)
+		mlfqs_tick (cpu, t);
 
 	/* 선점을 강제합니다. */
-	if (++thread_ticks >= TIME_SLICE)
+	if (++cpu->thread_ticks >= TIME_SLICE)
 		intr_yield_on_return ();
 }
 
-/* 스레드 통계를 출력합니다. */
+/* 스레드 통계를 출력합니다. 모든 CPU의 합계입니다. */
 void
 thread_print_stats (void) {
+	long long idle_ticks = 0, kernel_ticks = 0, user_ticks = 0;
+	long long steals = 0, migrations = 0;
+
+	for (int i = 0; i < cpu_cnt; i++) {
+		idle_ticks += cpus[i].idle_ticks;
+		kernel_ticks += cpus[i].kernel_ticks;
+		user_ticks += cpus[i].user_ticks;
+		steals += cpus[i].steals;
+		migrations += cpus[i].migrations;
+	}
 	printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
 			idle_ticks, kernel_ticks, user_ticks);
+	printf ("Balancer: %lld steals, %lld migrations\n", steals, migrations);
 }
 
 /* 주어진 초기 PRIORITY로 NAME이라는 새 커널 스레드를 생성하고,
@@ -281,6 +409,10 @@ thread_create (const char *name, int priority,
 	init_thread (t, name, priority);
 	tid = t->tid = allocate_tid ();
 
+	/* MLFQS 값은 부모로부터 물려받습니다. */
+	t->nice = thread_current ()->nice;
+	t->recent_cpu = thread_current ()->recent_cpu;
+
 	/* 스케줄링되면 kernel_thread를 호출합니다.
 	 * 참고) rdi는 첫 번째 인수이고, rsi는 두 번째 인수입니다. */
 	t->tf.rip = (uintptr_t) kernel_thread;
@@ -290,9 +422,11 @@ thread_create (const char *name, int priority,
 	t->tf.es = SEL_KDSEG;
 	t->tf.ss = SEL_KDSEG;
 	t->tf.cs = SEL_KCSEG; 
-	t->tf.eflags = FLAG_IF;
+	/* 실행 큐 락을 놓을 때까지 인터럽트는 꺼 둡니다 (kernel_thread). */
+	t->tf.eflags = FLAG_MBS;
 
-	/* 실행 큐에 추가합니다. */
+	/* 가장 한가한 CPU의 실행 큐에 추가합니다. */
+	t->cpu = thread_select_cpu ();
 	thread_unblock (t);
 
 	thread_preempt ();
@@ -308,12 +442,32 @@ thread_create (const char *name, int priority,
    더 좋은 방법입니다. */
 void
 thread_block (void) {
+	struct cpu *cpu = this_cpu ();
+
 	ASSERT (!intr_context ());
 	ASSERT (intr_get_level () == INTR_OFF);
+
+	spin_lock (&cpu->rq_lock);
 	thread_current ()->status = THREAD_BLOCKED;
 	schedule ();
 }
 
+/* thread_block()과 같지만, 차단 상태로 표시한 다음에 LOCK을 놓습니다.
+   LOCK을 잡고 대기 목록에 자신을 넣은 호출자는 다른 CPU가
+   thread_unblock()을 부르기 전에 잠들었음이 보장됩니다. */
+void
+thread_block_unlock (struct spinlock *lock) {
+	struct cpu *cpu = this_cpu ();
+
+	ASSERT (!intr_context ());
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	spin_lock (&cpu->rq_lock);
+	thread_current ()->status = THREAD_BLOCKED;
+	spin_unlock (lock);
+	schedule ();
+}
+
 /* 차단된 스레드 T를 실행 준비 상태로 전환합니다.
    T가 차단되지 않은 경우 오류입니다. (thread_yield()를 사용하여
    실행 중인 스레드를 준비 상태로 만드세요.)
@@ -321,46 +475,59 @@ thread_block (void) {
    이 함수는 실행 중인 스레드를 선점하지 않습니다. 이것은
    중요할 수 있습니다: 호출자가 인터럽트를 직접 비활성화한 경우,
    스레드를 원자적으로 차단 해제하고 다른 데이터를 업데이트할 수 있다고
-   기대할 수 있습니다. */
+   기대할 수 있습니다.
+
+   T는 마지막으로 실행된 CPU의 실행 큐로 들어갑니다. 그 CPU가
+   다른 CPU이고 T가 그곳에서 실행 중인 스레드보다 높은 우선순위라면
+   재스케줄링 IPI를 보냅니다. */
 void
 thread_unblock (struct thread *t) {
 	enum intr_level old_level;
+	struct cpu *cpu;
+	bool kick;
 
 	ASSERT (is_thread (t));
 
 	old_level = intr_disable ();
+	cpu = thread_rq_lock (t);
 	ASSERT (t->status == THREAD_BLOCKED);
-	list_insert_ordered (&ready_list, &t->elem, thread_priority_compare, NULL);
+	if (thread_mlfqs) {
+		/* 잠든 동안 밀린 감쇠를 반영하고 우선순위를 다시 계산합니다. */
+		mlfqs_catch_up (t);
+		t->priority = mlfqs_priority (t);
+	}
+	ready_queue_push (cpu, t);
 	t->status = THREAD_READY;
+	kick = cpu != this_cpu () && cpu->curr != NULL
+		&& t->priority > cpu->curr->priority;
+	spin_unlock (&cpu->rq_lock);
+
+	if (kick)
+		lapic_send_ipi (cpu->lapic_id, LAPIC_RESCHED_VEC);
 	intr_set_level (old_level);
 }
 
+// 잠든 스레드를 깨우는 타이머 콜백 (인터럽트 컨텍스트)
+static void
+thread_wake (void *wakeup_sema) {
+	sema_up (wakeup_sema);
+}
+
+// 타이머 틱이 TICKS가 될 때까지 현재 스레드를 재웁니다
 void
 thread_sleep (int64_t ticks) {
-	struct thread *cur = thread_current ();
+	struct semaphore wakeup_sema;
+	struct timer_event wakeup;
 
-	enum intr_level old_level = intr_disable ();
+	ASSERT (!intr_context ());
 
-	cur->sleep_until = ticks;
-	list_insert_ordered (&sleep_list, &cur->elem, thread_sleep_compare, NULL);
-	thread_block ();
-	intr_set_level (old_level);
-}
-
-void
-thread_wake (int64_t ticks) {
-	ASSERT (intr_context ());
-	while (!list_empty (&sleep_list)) {
-		struct list_elem *e = list_front (&sleep_list);
-		struct thread *t = list_entry (e, struct thread, elem);
-		if (t->sleep_until <= ticks) {
-			list_remove(e);
-			thread_unblock (t);
-		}
-		else
-			break;
-	}
-	thread_preempt ();
+	// 스레드가 깨어날 때까지 스택은 살아 있으니 이벤트를 스택에 둬도 됩니다.
+	// 콜백은 다른 CPU에서 돌 수 있으므로 thread_block() 대신 세마포어로
+	// 기다려 잠들기 전에 깨우는 경우를 막습니다.
+	sema_init (&wakeup_sema, 0);
+	timer_event_init (&wakeup, thread_wake, &wakeup_sema);
+	timer_event_arm (&wakeup, ticks);
+	sema_down (&wakeup_sema);
 }
 
 /* 실행 중인 스레드의 이름을 반환합니다. */
@@ -401,6 +568,7 @@ thread_exit (void) {
 #ifdef USERPROG
 	process_exit ();
 #endif
+	rwlock_free_spares ();
 
 	/* 상태를 dying으로 설정하고 다른 프로세스를 스케줄링합니다.
 	   schedule_tail() 호출 중에 파괴됩니다. */
@@ -413,14 +581,11 @@ thread_exit (void) {
    스케줄러의 판단에 따라 즉시 다시 스케줄링될 수 있습니다. */
 void
 thread_yield (void) {
-	struct thread *curr = thread_current ();
 	enum intr_level old_level;
 
 	ASSERT (!intr_context ());
 
 	old_level = intr_disable ();
-	if (curr != idle_thread)
-		list_insert_ordered (&ready_list, &curr->elem, thread_priority_compare, NULL);
 	do_schedule (THREAD_READY);
 	intr_set_level (old_level);
 }
@@ -428,12 +593,7 @@ thread_yield (void) {
 void thread_preempt (void) {
 	enum intr_level old_level = intr_disable ();
 
-	if (list_empty (&ready_list))
-		return;
-
-	struct thread *curr = thread_current ();
-	struct thread *next = list_entry (list_front (&ready_list), struct thread, elem);
-	if (next->priority > curr->priority) {
+	if (ready_queue_max_priority (this_cpu ()) > thread_current ()->priority) {
 		if (intr_context ())
 			intr_yield_on_return ();
 		else
@@ -446,11 +606,18 @@ void thread_preempt (void) {
 void
 thread_set_priority (int new_priority) {
 	struct thread *curr = thread_current ();
+
+	/* MLFQS에서는 스케줄러가 우선순위를 직접 정합니다. */
+	if (thread_mlfqs)
+		return;
+
 	enum intr_level old_level = intr_disable ();
 	int old_priority = curr->priority;
 
+	spin_lock (&donation_lock);
 	curr->default_priority = new_priority;
 	thread_update_priority (curr);
+	spin_unlock (&donation_lock);
 
 	intr_set_level (old_level);
   
@@ -466,29 +633,166 @@ thread_get_priority (void) {
 
 /* 현재 스레드의 nice 값을 NICE로 설정합니다. */
 void
-thread_set_nice (int nice UNUSED) {
-	/* TODO: 여기에 구현을 작성하세요 */
+thread_set_nice (int nice) {
+	struct thread *curr = thread_current ();
+
+	if (nice < NICE_MIN)
+		nice = NICE_MIN;
+	if (nice > NICE_MAX)
+		nice = NICE_MAX;
+
+	enum intr_level old_level = intr_disable ();
+	curr->nice = nice;
+	if (thread_mlfqs)
+		curr->priority = mlfqs_priority (curr);
+	intr_set_level (old_level);
+
+	// 더 높은 우선순위가 준비되어 있으면 양보합니다
+	thread_preempt ();
 }
 
 /* 현재 스레드의 nice 값을 반환합니다. */
 int
 thread_get_nice (void) {
-	/* TODO: 여기에 구현을 작성하세요 */
-	return 0;
+	return thread_current ()->nice;
 }
 
 /* 시스템 로드 평균의 100배를 반환합니다. */
 int
 thread_get_load_avg (void) {
-	/* TODO: 여기에 구현을 작성하세요 */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int load_avg_100 = fp_to_int_round (fp_mul_int (load_avg, 100));
+	intr_set_level (old_level);
+
+	return load_avg_100;
 }
 
 /* 현재 스레드의 recent_cpu 값의 100배를 반환합니다. */
 int
 thread_get_recent_cpu (void) {
-	/* TODO: 여기에 구현을 작성하세요 */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int recent_cpu_100 =
+		fp_to_int_round (fp_mul_int (thread_current ()->recent_cpu, 100));
+	intr_set_level (old_level);
+
+	return recent_cpu_100;
+}
+
+/* T의 MLFQS 우선순위를 계산합니다.
+   priority = PRI_MAX - (recent_cpu / 4) - (nice * 2) */
+static int
+mlfqs_priority (const struct thread *t) {
+	int priority = PRI_MAX - fp_to_int (fp_div_int (t->recent_cpu, 4))
+		- t->nice * 2;
+
+	if (priority < PRI_MIN)
+		return PRI_MIN;
+	if (priority > PRI_MAX)
+		return PRI_MAX;
+	return priority;
+}
+
+/* T가 마지막으로 갱신된 이후 지나간 초마다
+   recent_cpu = coef * recent_cpu + nice 를 적용합니다.
+   DECAY_HISTORY초보다 오래 잠들었다면 기억하는 만큼만 적용합니다.
+   그 정도면 이전 값은 거의 남지 않습니다. */
+static void
+mlfqs_catch_up (struct thread *t) {
+	int64_t sec = t->recent_cpu_epoch + 1;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (decay_seconds - t->recent_cpu_epoch > DECAY_HISTORY)
+		sec = decay_seconds - DECAY_HISTORY + 1;
+	for (; sec <= decay_seconds; sec++)
+		t->recent_cpu = fp_add_int (
+				fp_mul (decay_history[sec % DECAY_HISTORY], t->recent_cpu),
+				t->nice);
+	t->recent_cpu_epoch = decay_seconds;
+}
+
+/* 타이머 틱마다 인터럽트 컨텍스트에서 호출됩니다.
+   실행 중인 스레드 T의 recent_cpu만 틱마다 증가하므로,
+   준비된 스레드들의 우선순위는 1초마다만 바뀝니다. */
+static void
+mlfqs_tick (struct cpu *cpu, struct thread *t) {
+	int64_t now = timer_ticks ();
+
+	if (t != cpu->idle_thread) {
+		/* 다른 CPU가 초를 넘겼다면 먼저 감쇠를 반영합니다. */
+		if (t->recent_cpu_epoch != decay_seconds)
+			mlfqs_catch_up (t);
+		t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+	}
+
+	/* 1초 단위 갱신은 부팅 CPU 한 곳에서만 합니다. */
+	if (cpu == &cpus[0] && now % TIMER_FREQ == 0)
+		mlfqs_second ();
+	else if (now % PRI_UPDATE_TICKS == 0 && t != cpu->idle_thread)
+		t->priority = mlfqs_priority (t);
+
+	if (ready_queue_max_priority (cpu) > t->priority)
+		intr_yield_on_return ();
+}
+
+/* 1초마다 load_avg를 갱신하고, 실행 중인 스레드와 준비된
+   스레드의 recent_cpu와 우선순위를 다시 계산합니다.
+   잠든 스레드는 깨어날 때 mlfqs_catch_up()으로 따라잡고,
+   다른 CPU에서 실행 중인 스레드는 그 CPU의 다음 틱에 따라잡습니다. */
+static void
+mlfqs_second (void) {
+	struct thread *curr = thread_current ();
+	struct cpu *self = this_cpu ();
+	int ready_threads = 0;
+	struct list ready;
+	fixed_t twice_load;
+
+	ASSERT (intr_context ());
+
+	for (int i = 0; i < cpu_cnt; i++)
+		if (cpus[i].started)
+			ready_threads += cpu_load (&cpus[i]);
+
+	/* load_avg = (59/60) * load_avg + (1/60) * ready_threads */
+	load_avg = fp_div_int (fp_add_int (fp_mul_int (load_avg, 59),
+				ready_threads), 60);
+
+	/* coef = (2 * load_avg) / (2 * load_avg + 1) */
+	twice_load = fp_mul_int (load_avg, 2);
+	decay_seconds++;
+	decay_history[decay_seconds % DECAY_HISTORY] =
+		fp_div (twice_load, fp_add_int (twice_load, 1));
+
+	if (curr != self->idle_thread) {
+		mlfqs_catch_up (curr);
+		curr->priority = mlfqs_priority (curr);
+	}
+
+	/* 각 CPU의 준비 큐를 높은 우선순위부터 비워 순서를 유지한 채
+	   다시 넣습니다. */
+	for (int i = 0; i < cpu_cnt; i++) {
+		struct cpu *cpu = &cpus[i];
+
+		if (!cpu->started)
+			continue;
+		spin_lock (&cpu->rq_lock);
+		list_init (&ready);
+		while (cpu->ready_mask != 0) {
+			int pri = ready_queue_max_priority (cpu);
+			while (!list_empty (&cpu->ready_queues[pri]))
+				list_push_back (&ready, list_pop_front (&cpu->ready_queues[pri]));
+			cpu->ready_mask &= ~(1ULL << pri);
+		}
+		cpu->ready_count = 0;
+
+		while (!list_empty (&ready)) {
+			struct thread *t = list_entry (list_pop_front (&ready), struct thread, elem);
+			mlfqs_catch_up (t);
+			t->priority = mlfqs_priority (t);
+			ready_queue_push (cpu, t);
+		}
+		spin_unlock (&cpu->rq_lock);
+	}
 }
 
 /* 유휴 스레드. 다른 스레드가 실행 준비가 되지 않았을 때 실행됩니다.
@@ -503,12 +807,23 @@ static void
 idle (void *idle_started_ UNUSED) {
 	struct semaphore *idle_started = idle_started_;
 
-	idle_thread = thread_current ();
+	intr_disable ();
+	this_cpu ()->idle_thread = thread_current ();
+	intr_enable ();
 	sema_up (idle_started);
 
+	idle_loop ();
+}
+
+/* idle 스레드의 본체. 응용 프로세서의 idle 스레드는
+   thread_start_ap()에서 바로 여기로 들어옵니다. */
+static void
+idle_loop (void) {
 	for (;;) {
-		/* 다른 스레드가 실행되도록 합니다. */
+		/* 다른 스레드가 실행되도록 합니다. 준비된 스레드가 없으면
+		   먼저 다른 CPU에서 훔쳐 옵니다. */
 		intr_disable ();
+		thread_steal (this_cpu ());
 		thread_block ();
 
 		/* 인터럽트를 다시 활성화하고 다음 인터럽트를 기다립니다.
@@ -530,6 +845,7 @@ static void
 kernel_thread (thread_func *function, void *aux) {
 	ASSERT (function != NULL);
 
+	schedule_tail ();     /* 전환해 준 CPU의 실행 큐 락을 놓습니다. */
 	intr_enable ();       /* 스케줄러는 인터럽트가 꺼진 상태에서 실행됩니다. */
 	function (aux);       /* 스레드 함수를 실행합니다. */
 	thread_exit ();       /* function()이 반환되면 스레드를 종료합니다. */
@@ -553,20 +869,198 @@ init_thread (struct thread *t, const char *name, int priority) {
 	t->priority = priority;
 	t->default_priority = priority;
 	t->waiting_lock = NULL;
-	list_init(&t->donation_list);
+	t->waiting_hold = NULL;
+	t->nice = NICE_DEFAULT;
+	t->recent_cpu = 0;
+	t->recent_cpu_epoch = decay_seconds;
+	list_init(&t->held_locks);
+	list_init(&t->rwlock_holds);
+	list_init(&t->rwlock_spares);
 	list_init(&t->child_list);
 }
 
-/* 스케줄링할 다음 스레드를 선택하고 반환합니다.
+/* CPU에서 스케줄링할 다음 스레드를 선택하고 반환합니다.
    실행 큐가 비어 있지 않으면 실행 큐에서 스레드를 반환해야 합니다.
    (실행 중인 스레드가 계속 실행할 수 있다면 실행 큐에 있을 것입니다.)
-   실행 큐가 비어 있으면 idle_thread를 반환합니다. */
+   실행 큐가 비어 있으면 CPU의 idle 스레드를 반환합니다. */
 static struct thread *
-next_thread_to_run (void) {
-	if (list_empty (&ready_list))
-		return idle_thread;
-	else
-		return list_entry (list_pop_front (&ready_list), struct thread, elem);
+next_thread_to_run (struct cpu *cpu) {
+	int pri = ready_queue_max_priority (cpu);
+
+	if (pri < PRI_MIN)
+		return cpu->idle_thread;
+	else {
+		struct thread *t = list_entry (list_pop_front (&cpu->ready_queues[pri]),
+				struct thread, elem);
+		if (list_empty (&cpu->ready_queues[pri]))
+			cpu->ready_mask &= ~(1ULL << pri);
+		cpu->ready_count--;
+		return t;
+	}
+}
+
+/* T를 CPU의 우선순위 큐 맨 뒤에 넣습니다.
+   같은 우선순위 안에서는 라운드 로빈 순서가 유지됩니다. */
+static void
+ready_queue_push (struct cpu *cpu, struct thread *t) {
+	ASSERT (spin_holding (&cpu->rq_lock));
+	ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+	list_push_back (&cpu->ready_queues[t->priority], &t->elem);
+	cpu->ready_mask |= 1ULL << t->priority;
+	cpu->ready_count++;
+}
+
+/* 준비 상태인 T를 CPU의 우선순위 큐에서 빼냅니다. */
+static void
+ready_queue_remove (struct cpu *cpu, struct thread *t) {
+	ASSERT (spin_holding (&cpu->rq_lock));
+	ASSERT (t->status == THREAD_READY);
+
+	list_remove (&t->elem);
+	if (list_empty (&cpu->ready_queues[t->priority]))
+		cpu->ready_mask &= ~(1ULL << t->priority);
+	cpu->ready_count--;
+}
+
+/* T의 실제 우선순위를 PRIORITY로 바꿉니다.
+   준비 큐는 우선순위별로 나뉘어 있으므로 준비 상태라면 옮겨 줍니다. */
+static void
+thread_set_effective_priority (struct thread *t, int priority) {
+	enum intr_level old_level = intr_disable ();
+	struct cpu *cpu = thread_rq_lock (t);
+
+	if (t->status == THREAD_READY && t->priority != priority) {
+		ready_queue_remove (cpu, t);
+		t->priority = priority;
+		ready_queue_push (cpu, t);
+	} else
+		t->priority = priority;
+
+	spin_unlock (&cpu->rq_lock);
+	intr_set_level (old_level);
+}
+
+/* CPU의 준비 큐에서 가장 높은 우선순위를 반환합니다.
+   준비된 스레드가 없으면 PRI_MIN - 1을 반환합니다. */
+static int
+ready_queue_max_priority (const struct cpu *cpu) {
+	if (cpu->ready_mask == 0)
+		return PRI_MIN - 1;
+	return 63 - __builtin_clzll (cpu->ready_mask);
+}
+
+/* T가 속한 CPU의 실행 큐 락을 잡고 그 CPU를 반환합니다.
+   락을 기다리는 동안 T가 다른 CPU로 옮겨졌다면 다시 시도합니다.
+   인터럽트가 꺼져 있어야 합니다. */
+static struct cpu *
+thread_rq_lock (struct thread *t) {
+	for (;;) {
+		struct cpu *cpu = t->cpu;
+
+		spin_lock (&cpu->rq_lock);
+		if (cpu == t->cpu)
+			return cpu;
+		spin_unlock (&cpu->rq_lock);
+	}
+}
+
+/* CPU가 맡은 스레드 수: 준비된 스레드와 실행 중인 스레드. */
+static int
+cpu_load (const struct cpu *cpu) {
+	return cpu->ready_count
+		+ (cpu->curr != NULL && cpu->curr != cpu->idle_thread ? 1 : 0);
+}
+
+/* 준비된 스레드가 없는 SELF가 가장 많은 스레드가 기다리는 CPU에서
+   가장 높은 우선순위 큐의 절반을 훔쳐 옵니다. 큐의 뒤쪽, 즉 가장
+   늦게 실행될 스레드부터 가져옵니다. 하나라도 옮겼으면 true를
+   반환합니다. 인터럽트가 꺼져 있어야 합니다. */
+static bool
+thread_steal (struct cpu *self) {
+	struct cpu *victim = NULL;
+	int most_waiting = 0;
+	int64_t now;
+	int moved = 0;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (cpu_cnt == 1 || self->ready_count > 0)
+		return false;
+	now = timer_ticks ();
+	if (now < self->steal_after)
+		return false;
+
+	/* 락 없이 후보를 고르고, 락을 잡은 뒤에 다시 확인합니다. */
+	for (int i = 0; i < cpu_cnt; i++) {
+		struct cpu *cpu = &cpus[i];
+
+		if (cpu != self && cpu->started && cpu->ready_count > most_waiting) {
+			victim = cpu;
+			most_waiting = cpu->ready_count;
+		}
+	}
+
+	if (victim != NULL) {
+		/* 교착 상태를 피하려고 두 실행 큐 락을 CPU 번호 순서로 잡습니다. */
+		struct cpu *first = self->id < victim->id ? self : victim;
+		struct cpu *second = first == self ? victim : self;
+		int pri;
+
+		spin_lock (&first->rq_lock);
+		spin_lock (&second->rq_lock);
+
+		pri = ready_queue_max_priority (victim);
+		if (pri >= PRI_MIN) {
+			struct list *queue = &victim->ready_queues[pri];
+			int quota = (list_size (queue) + 1) / 2;
+			struct list_elem *e = list_rbegin (queue);
+
+			while (e != list_rend (queue) && moved < quota) {
+				struct thread *t = list_entry (e, struct thread, elem);
+
+				e = list_prev (e);
+				if (now - t->last_ran < CACHE_HOT_TICKS)
+					continue;
+				ready_queue_remove (victim, t);
+				t->cpu = self;
+				ready_queue_push (self, t);
+				moved++;
+			}
+		}
+
+		spin_unlock (&second->rq_lock);
+		spin_unlock (&first->rq_lock);
+	}
+
+	if (moved == 0) {
+		self->steal_after = now + STEAL_COOLDOWN;
+		return false;
+	}
+	self->steals++;
+	self->migrations += moved;
+	return true;
+}
+
+/* 새 스레드를 놓을 CPU로 가장 한가한 CPU를 고릅니다.
+   같으면 현재 CPU를 택해 캐시를 살립니다. 락 없이 읽으므로
+   대략적인 값이지만 배치에는 충분합니다. */
+static struct cpu *
+thread_select_cpu (void) {
+	enum intr_level old_level = intr_disable ();
+	struct cpu *best = this_cpu ();
+	int best_load = cpu_load (best);
+
+	for (int i = 0; i < cpu_cnt; i++) {
+		struct cpu *cpu = &cpus[i];
+
+		if (cpu->started && cpu_load (cpu) < best_load) {
+			best = cpu;
+			best_load = cpu_load (cpu);
+		}
+	}
+	intr_set_level (old_level);
+	return best;
 }
 
 /* iretq를 사용하여 스레드를 시작합니다 */
@@ -669,30 +1163,44 @@ thread_launch (struct thread *th) {
  * schedule()에서 printf()를 호출하는 것은 안전하지 않습니다. */
 static void
 do_schedule(int status) {
+	struct thread *curr = thread_current ();
+	struct cpu *cpu = this_cpu ();
+
 	ASSERT (intr_get_level () == INTR_OFF);
-	ASSERT (thread_current()->status == THREAD_RUNNING);
-	while (!list_empty (&destruction_req)) {
+	ASSERT (curr->status == THREAD_RUNNING);
+	while (!list_empty (&cpu->destruction_req)) {
 		struct thread *victim =
-			list_entry (list_pop_front (&destruction_req), struct thread, elem);
+			list_entry (list_pop_front (&cpu->destruction_req), struct thread, elem);
 		palloc_free_page(victim);
 	}
-	thread_current ()->status = status;
+
+	spin_lock (&cpu->rq_lock);
+	curr->status = status;
+	if (status == THREAD_READY && curr != cpu->idle_thread)
+		ready_queue_push (cpu, curr);
 	schedule ();
 }
 
+/* 현재 CPU의 다음 스레드로 전환합니다. 진입 시 인터럽트가 꺼져 있고
+   현재 CPU의 실행 큐 락을 잡고 있어야 합니다. 락은 전환되어 들어온
+   스레드가 schedule_tail()에서 놓습니다. */
 static void
 schedule (void) {
+	struct cpu *cpu = this_cpu ();
 	struct thread *curr = running_thread ();
-	struct thread *next = next_thread_to_run ();
+	struct thread *next = next_thread_to_run (cpu);
 
 	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (spin_holding (&cpu->rq_lock));
 	ASSERT (curr->status != THREAD_RUNNING);
 	ASSERT (is_thread (next));
 	/* 실행 중으로 표시합니다. */
 	next->status = THREAD_RUNNING;
+	next->cpu = cpu;
+	cpu->curr = next;
 
 	/* 새 타임 슬라이스를 시작합니다. */
-	thread_ticks = 0;
+	cpu->thread_ticks = 0;
 
 #ifdef USERPROG
 	/* Activate the new address space. */
@@ -700,6 +1208,8 @@ schedule (void) {
 #endif
 
 	if (curr != next) {
+		curr->last_ran = timer_ticks ();
+
 		/* 전환한 스레드가 dying 상태이면 그 struct thread를 파괴합니다.
 		   이것은 늦게 발생해야 하므로 thread_exit()이 자신의 기반을
 		   제거하지 않습니다.
@@ -708,24 +1218,27 @@ schedule (void) {
 		   실제 파괴 로직은 schedule()의 시작 부분에서 호출됩니다. */
 		if (curr && curr->status == THREAD_DYING && curr != initial_thread) {
 			ASSERT (curr != next);
-			list_push_back (&destruction_req, &curr->elem);
+			list_push_back (&cpu->destruction_req, &curr->elem);
 		}
 
 		/* 스레드를 전환하기 전에 먼저 현재 실행 중인
 		 * 정보를 저장합니다. */
 		thread_launch (next);
 	}
+	schedule_tail ();
+}
+
+/* 문맥 전환을 마무리합니다. 전환되어 들어온 스레드가 전환을 시작한
+   CPU, 즉 지금 자신이 실행 중인 CPU의 실행 큐 락을 놓습니다. */
+static void
+schedule_tail (void) {
+	spin_unlock (&this_cpu ()->rq_lock);
 }
 
 /* 새 스레드에 사용할 tid를 반환합니다. */
 static tid_t
 allocate_tid (void) {
 	static tid_t next_tid = 1;
-	tid_t tid;
 
-	lock_acquire (&tid_lock);
-	tid = next_tid++;
-	lock_release (&tid_lock);
-
-	return tid;
+	return __atomic_fetch_add (&next_tid, 1, __ATOMIC_RELAXED);
 }
@@ -1,8 +1,10 @@
 #include "userprog/gdt.h"
 #include <debug.h>
+#include <string.h>
 #include "userprog/tss.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
 
@@ -61,7 +63,10 @@ struct segment_descriptor64 {
 	type, 1, dpl, 1, (unsigned) (lim) >> 28, 0, 1, 0, 1, \
 	(unsigned) (base) >> 24 }
 
-static struct segment_desc gdt[SEL_CNT] = {
+/* Every CPU loads its own copy of this table, because each
+   one's TSS descriptor points to that CPU's TSS and is marked
+   busy by ltr. */
+static const struct segment_desc gdt_template[SEL_CNT] = {
 	[SEL_NULL >> 3] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 	[SEL_KCSEG >> 3] = SEG64 (0xa, 0x0, 0xffffffff, 0),
 	[SEL_KDSEG >> 3] = SEG64 (0x2, 0x0, 0xffffffff, 0),
@@ -72,16 +77,24 @@ static struct segment_desc gdt[SEL_CNT] = {
 	[7] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 
-struct desc_ptr gdt_ds = {
-	.size = sizeof(gdt) - 1,
-	.address = (uint64_t) gdt
-};
+static struct segment_desc gdts[NCPU_MAX][SEL_CNT];
 
-/* Sets up a proper GDT.  The bootstrap loader's GDT didn't
-   include user-mode selectors or a TSS, but we need both now. */
+/* Sets up a proper GDT on the running CPU.  The bootstrap
+   loader's GDT didn't include user-mode selectors or a TSS, but
+   we need both now.  Must be called after tss_init(), with
+   interrupts off. */
 void
 gdt_init (void) {
+	struct segment_desc *gdt = gdts[this_cpu ()->id];
+	struct desc_ptr gdt_ds = {
+		.size = sizeof gdts[0] - 1,
+		.address = (uint64_t) gdt
+	};
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
 	/* Initialize GDT. */
+	memcpy (gdt, gdt_template, sizeof gdt_template);
 	struct segment_descriptor64 *tss_desc =
 		(struct segment_descriptor64 *) &gdt[SEL_TSS >> 3];
 	struct task_state *tss = tss_get ();
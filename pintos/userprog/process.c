@@ -54,9 +54,7 @@ do_close_fd(struct thread *t, int fd) {
     if (f == NULL)
         return false;
 
-    lock_acquire(&filesys_lock);
     file_close(f);
-    lock_release(&filesys_lock);
 
     t->fd_table[fd] = NULL;
 	
@@ -197,6 +195,12 @@ process_fork (const char *name, struct intr_frame *if_) {
 
 	sema_down(&args->fork_done);
 
+#ifdef VM
+	/* 자식과 공유하게 된 페이지는 읽기 전용으로 바뀌었으므로,
+	 * 이 CPU의 TLB에 남은 쓰기 가능한 항목을 비웁니다. */
+	pml4_flush (parent->pml4);
+#endif
+
 	bool ok = args->success;
 	palloc_free_page(args);
 
@@ -331,6 +335,13 @@ process_exec (void *f_name) {
 	_if.cs = SEL_UCSEG;
 	_if.eflags = FLAG_IF | FLAG_MBS;
 
+#ifdef VM
+	/* 실패하면 기존 주소 공간으로 돌아가야 하므로
+	 * 새 이미지는 빈 SPT에 올리고 기존 SPT는 따로 보관합니다. */
+	struct supplemental_page_table old_spt = t->spt;
+	supplemental_page_table_init (&t->spt);
+#endif
+
 	success = load (file_name, &_if);
 	palloc_free_page (file_name);
 
@@ -340,20 +351,25 @@ process_exec (void *f_name) {
 		t->pml4 = old_pml4;
 		process_activate(t);
 
+#ifdef VM
+		supplemental_page_table_kill (&t->spt);
+		t->spt = old_spt;
+#endif
 		if (new_pml4 != NULL && new_pml4 != old_pml4)
 			pml4_destroy(new_pml4);
 
 		return -1;
 	}
 
+#ifdef VM
+	supplemental_page_table_kill (&old_spt);
+#endif
 	if (old_pml4 != NULL && old_pml4 != t->pml4)
 		pml4_destroy (old_pml4);
 
 	if (old_exec != NULL && old_exec != t->exec_file) {
-		lock_acquire(&filesys_lock);
 		file_allow_write(old_exec);
         file_close(old_exec);
-        lock_release(&filesys_lock);
 	}
 
 	do_iret (&_if);
@@ -429,18 +445,14 @@ process_exit (void) {
 	for (int fd = 2; fd < FD_MAX; fd++) {
 		struct file *f = curr->fd_table[fd];
 		if (f != NULL) {
-			lock_acquire(&filesys_lock);
             file_close(f);
-            lock_release(&filesys_lock);
             curr->fd_table[fd] = NULL;
 		}
 	}
 
 	if (curr->exec_file != NULL) {
-		lock_acquire(&filesys_lock);
 		file_allow_write(curr->exec_file);
 		file_close(curr->exec_file);
-		lock_release(&filesys_lock);
 		curr->exec_file = NULL;
 	}
 
@@ -569,9 +581,7 @@ load (const char *file_name, struct intr_frame *if_) {
 	process_activate (thread_current ());
 
 	/* 실행 파일을 엽니다. */
-	lock_acquire(&filesys_lock);
 	file = filesys_open (token);
-	lock_release(&filesys_lock);
 	if (file == NULL) {
 		printf("load: %s: open failed\n", token);
 		goto done;
@@ -655,10 +665,8 @@ load (const char *file_name, struct intr_frame *if_) {
 	if (!load_argument (file_name, if_))
 		goto done;
 
-	lock_acquire(&filesys_lock);
 	t->exec_file = file;
 	file_deny_write(file);
-	lock_release(&filesys_lock);
 	
 	success = true;
 
@@ -876,13 +884,6 @@ install_page (void *upage, void *kpage, bool writable) {
  * 프로젝트 2 전용으로 함수를 구현하려면
  * 위 블록에 구현하세요. */
 
-static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: 파일에서 세그먼트를 로드합니다 */
-	/* TODO: 주소 VA에서 첫 번째 페이지 폴트가 발생할 때 호출됩니다. */
-	/* TODO: 이 함수를 호출할 때 VA를 사용할 수 있습니다. */
-}
-
 /* FILE의 오프셋 OFS에서 시작하는 세그먼트를 주소
  * UPAGE에 로드합니다. 총 READ_BYTES + ZERO_BYTES 바이트의 가상
  * 메모리가 다음과 같이 초기화됩니다:
@@ -911,16 +912,25 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: lazy_load_segment에 정보를 전달하기 위해 aux를 설정합니다. */
-		void *aux = NULL;
+		/* 실제 읽기는 첫 폴트 때 file_lazy_load()에서 합니다.
+		 * 전부 0인 페이지는 파일을 건드릴 필요가 없습니다. */
+		struct file_segment *aux = NULL;
+		if (page_read_bytes > 0) {
+			aux = file_segment_create (file, ofs, page_read_bytes);
+			if (aux == NULL)
+				return false;
+		}
 		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
+					writable, aux != NULL ? file_lazy_load : NULL, aux)) {
+			file_segment_free (aux);
 			return false;
+		}
 
 		/* 진행합니다. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += PGSIZE;
 	}
 	return true;
 }
@@ -931,10 +941,13 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: stack_bottom에 스택을 매핑하고 페이지를 즉시 클레임합니다.
-	 * TODO: 성공하면 그에 따라 rsp를 설정합니다.
-	 * TODO: 페이지가 스택임을 표시해야 합니다. */
-	/* TODO: 여기에 코드를 작성하세요 */
+	/* 인자를 바로 써 넣어야 하므로 첫 스택 페이지는 즉시 클레임합니다. */
+	if (vm_alloc_page (VM_ANON, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		thread_current ()->spt.stack_bottom = stack_bottom;
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 
 	return success;
 }
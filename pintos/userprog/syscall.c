@@ -6,6 +6,7 @@
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
 #include "userprog/gdt.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
@@ -14,8 +15,6 @@
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
 
-struct lock filesys_lock;
-
 /* 시스템 호출.
  *
  * 이전에는 시스템 호출 서비스가 인터럽트 핸들러에 의해 처리되었습니다
@@ -28,12 +27,22 @@ struct lock filesys_lock;
 #define MSR_STAR 0xc0000081         /* 세그먼트 선택자 msr */
 #define MSR_LSTAR 0xc0000082        /* 롱 모드 SYSCALL 대상 */
 #define MSR_SYSCALL_MASK 0xc0000084 /* eflags용 마스크 */
+#define MSR_KERNEL_GS_BASE 0xc0000102 /* swapgs로 바꿔 넣을 gs 베이스 */
 
 /* 초기화 함수 */
 
 void
 syscall_init (void) {
-	lock_init(&filesys_lock);
+	syscall_init_ap ();
+}
+
+/* 현재 CPU의 syscall MSR을 설정합니다. MSR은 CPU마다 따로 있으므로
+ * 응용 프로세서도 부팅할 때 이 함수를 호출합니다. 인터럽트가 꺼져
+ * 있어야 합니다. */
+void
+syscall_init_ap (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
 			((uint64_t)SEL_KCSEG) << 32);
 	write_msr(MSR_LSTAR, (uint64_t) syscall_entry);
@@ -43,6 +52,10 @@ syscall_init (void) {
 	 * 따라서 FLAG_FL을 마스크했습니다. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
+
+	/* syscall_entry는 swapgs 후 %gs로 이 CPU의 TSS와 임시 저장소를
+	 * 찾습니다. */
+	write_msr(MSR_KERNEL_GS_BASE, (uint64_t) this_cpu ());
 }
 
 /* 헬퍼 함수들 */
@@ -174,9 +187,7 @@ syscall_read(int fd, void *buffer, unsigned size) {
 
 	while (remaining > 0) {
 		unsigned chunk = remaining > PGSIZE ? PGSIZE : remaining;
-		lock_acquire(&filesys_lock);
 		int n = file_read(f, kbuf, chunk);
-		lock_release(&filesys_lock);
 
 		if (n <= 0)
 			break;
@@ -213,11 +224,40 @@ syscall_write(int fd, const void *buffer, unsigned length) {
 	if (f == NULL)
 		return -1;
 
-	lock_acquire(&filesys_lock);
-	int ret = file_write(f, buffer, length);
-	lock_release(&filesys_lock);
+	/* 사용자 버퍼를 커널 페이지로 먼저 복사합니다. 파일 시스템 락을
+	 * 잡은 채로 사용자 페이지에서 폴트가 나면, frame_lock을 잡고 같은
+	 * 파일로 mmap 페이지를 내보내는 스레드와 서로 기다리게 됩니다. */
+	uint8_t *kbuf = palloc_get_page(0);
+	if (kbuf == NULL)
+		syscall_exit(-1);
+
+	unsigned remaining = length;
+	unsigned written = 0;
 
-	return ret;
+	while (remaining > 0) {
+		unsigned chunk = remaining > PGSIZE ? PGSIZE : remaining;
+
+		for (unsigned i = 0; i < chunk; i++) {
+			int64_t val = get_user((const uint8_t *)buffer + written + i);
+			if (val == -1) {
+				palloc_free_page(kbuf);
+				syscall_exit(-1);
+			}
+			kbuf[i] = (uint8_t)val;
+		}
+
+		int n = file_write(f, kbuf, chunk);
+
+		if (n <= 0)
+			break;
+		written += n;
+		remaining -= n;
+
+		if ((unsigned)n < chunk)
+			break;
+	}
+	palloc_free_page(kbuf);
+	return written;
 }
 
 static bool
@@ -235,9 +275,7 @@ syscall_remove(const char* filename) {
 		return false;
 	}
 
-	lock_acquire(&filesys_lock);
     bool ok = filesys_remove(kname);
-    lock_release(&filesys_lock);
 
 	palloc_free_page(kname);
 	
@@ -261,9 +299,7 @@ syscall_open(const char* filename) {
 		return -1;
 	}
 
-	lock_acquire(&filesys_lock);
 	struct file *f = filesys_open(kname);
-	lock_release(&filesys_lock);
 
 	palloc_free_page(kname);
 
@@ -273,9 +309,7 @@ syscall_open(const char* filename) {
 	int fd = fd_insert(f);
 	
 	if (fd == -1) {
-		lock_acquire(&filesys_lock);
 		file_close(f);
-		lock_release(&filesys_lock);
 	}
 
 	return fd;
@@ -311,9 +345,7 @@ syscall_create (const char *file, unsigned initial_size) {
         return false;
     }
 
-    lock_acquire(&filesys_lock);
     bool ok = filesys_create(kname, initial_size);
-    lock_release(&filesys_lock);
 
     palloc_free_page(kname);
 
@@ -326,9 +358,7 @@ syscall_filesize (int fd) {
 	if (f == NULL)
 		return -1;
 
-	lock_acquire(&filesys_lock);
 	int length = file_length(f);
-	lock_release(&filesys_lock);
 
 	return length;
 }
@@ -339,9 +369,7 @@ syscall_seek (int fd, unsigned position) {
 	if (f == NULL)
 		return;
 
-	lock_acquire(&filesys_lock);
 	file_seek(f, position);
-	lock_release(&filesys_lock);
 }
 
 static unsigned
@@ -350,9 +378,7 @@ syscall_tell (int fd) {
 	if (f == NULL)
 		return 0;
 
-	lock_acquire(&filesys_lock);
 	int position = file_tell(f);
-	lock_release(&filesys_lock);
 
 	return position;
 }
@@ -382,10 +408,27 @@ syscall_exec (const char *cmd_line) {
 	return ret;
 }
 
+#ifdef VM
+static void *
+syscall_mmap (void *addr, size_t length, int writable, int fd, off_t offset) {
+	struct file *f = find_file_by_fd(fd);
+
+	/* 표준 입출력은 매핑할 수 없습니다. */
+	if (f == NULL || fd < 2)
+		return NULL;
+
+	return do_mmap(addr, length, writable, f, offset);
+}
+#endif
+
 /* 주요 시스템 호출 인터페이스 */
 void
 syscall_handler (struct intr_frame *f) {
 	// TODO: 여기에 구현을 작성하세요.
+#ifdef VM
+	/* 커널 안에서 사용자 스택에 폴트가 나면 이 값으로 스택 성장을 판단합니다. */
+	thread_current ()->user_rsp = f->rsp;
+#endif
 	switch (f->R.rax) {
 		case SYS_HALT:
 			power_off();
@@ -429,6 +472,15 @@ syscall_handler (struct intr_frame *f) {
 		case SYS_TELL:
 			f->R.rax = syscall_tell((int)f->R.rdi);
 			break;
+#ifdef VM
+		case SYS_MMAP:
+			f->R.rax = (uint64_t)syscall_mmap((void *)f->R.rdi, f->R.rsi,
+					(int)f->R.rdx, (int)f->R.r10, (off_t)f->R.r8);
+			break;
+		case SYS_MUNMAP:
+			do_munmap((void *)f->R.rdi);
+			break;
+#endif
 		default:
 			break;
 	}
@@ -4,6 +4,7 @@
 #include "userprog/gdt.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
 
@@ -45,22 +46,33 @@
  *      stack pointer to point to the new thread's kernel stack.
  *      (The call is in schedule in thread.c.) */
 
-/* Kernel TSS. */
-struct task_state *tss;
+/* Each CPU has its own kernel TSS, pointed to by its struct cpu,
+   since each runs a different thread on a different kernel
+   stack. */
 
-/* Initializes the kernel TSS. */
+/* Initializes the running CPU's kernel TSS.  Interrupts must be
+   off.  Application processors run this on their idle thread,
+   which must not sleep, so smp_init() allocates their TSS pages
+   for them beforehand. */
 void
 tss_init (void) {
+	struct cpu *cpu = this_cpu ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
 	/* Our TSS is never used in a call gate or task gate, so only a
 	 * few fields of it are ever referenced, and those are the only
 	 * ones we initialize. */
-	tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	if (cpu->tss == NULL)
+		cpu->tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 	tss_update (thread_current ());
 }
 
 /* Returns the kernel TSS. */
 struct task_state *
 tss_get (void) {
+	struct task_state *tss = this_cpu ()->tss;
+
 	ASSERT (tss != NULL);
 	return tss;
 }
@@ -69,6 +81,11 @@ tss_get (void) {
  * of the thread stack. */
 void
 tss_update (struct thread *next) {
+	/* Stay on this CPU until we have written its TSS. */
+	enum intr_level old_level = intr_disable ();
+	struct task_state *tss = this_cpu ()->tss;
+
 	ASSERT (tss != NULL);
 	tss->rsp0 = (uint64_t) next + PGSIZE;
+	intr_set_level (old_level);
 }
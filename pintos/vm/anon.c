@@ -1,7 +1,20 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap slots hold one page each. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Most pages whose write to swap is deferred to anon_swap_flush(). */
+#define SWAP_BATCH 16
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +30,228 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+static struct bitmap *swap_slots;    /* Set bits are slots in use. */
+static uint16_t *swap_refs;          /* Pages referring to each slot. */
+static size_t swap_hint;             /* Where the next slot search starts. */
+static struct mutex swap_lock;       /* Protects the three above. */
+
+/* A page whose slot is reserved but not yet written. */
+struct swap_write {
+	size_t slot;
+	const void *kva;
+};
+
+/* Pending writes.  Only the thread that is evicting, which holds the
+ * frame table lock, touches these. */
+static struct swap_write swap_batch[SWAP_BATCH];
+static size_t swap_batch_cnt;
+
+/* Statistics. */
+static long long swap_out_cnt;       /* Pages written to swap. */
+static long long swap_batch_writes;  /* Batches those were written in. */
+static long long swap_in_cnt;        /* Pages read back. */
+static long long swap_clean_cnt;     /* Evictions that needed no write. */
+
+static size_t swap_slot_alloc (unsigned refs);
+static void swap_slot_get (size_t slot);
+static void swap_slot_put (size_t slot);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	swap_slots = bitmap_create (swap_disk != NULL
+			? disk_size (swap_disk) / SECTORS_PER_SLOT : 0);
+	swap_refs = calloc (bitmap_size (swap_slots), sizeof *swap_refs);
+	if (swap_slots == NULL || swap_refs == NULL)
+		PANIC ("out of memory for swap bitmap");
+	mutex_init (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+anon_print_stats (void) {
+	printf ("Swap: %lld pages out in %lld batches, %lld pages in, "
+			"%lld clean evictions\n",
+			swap_out_cnt, swap_batch_writes, swap_in_cnt, swap_clean_cnt);
+}
+
+/* Reserves a free swap slot for REFS pages and returns it, or
+ * BITMAP_ERROR if swap is full.  Searching from just past the last
+ * slot handed out keeps the slots of one eviction batch next to each
+ * other on disk. */
+static size_t
+swap_slot_alloc (unsigned refs) {
+	size_t slot;
+
+	mutex_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_slots, swap_hint, 1, false);
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip (swap_slots, 0, 1, false);
+	if (slot != BITMAP_ERROR) {
+		swap_refs[slot] = refs;
+		swap_hint = slot + 1;
+	}
+	mutex_release (&swap_lock);
+	return slot;
+}
+
+/* Adds a reference to SLOT. */
+static void
+swap_slot_get (size_t slot) {
+	mutex_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_slots, slot));
+	swap_refs[slot]++;
+	mutex_release (&swap_lock);
+}
+
+/* Drops a reference to SLOT, releasing it with the last one. */
+static void
+swap_slot_put (size_t slot) {
+	mutex_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_slots, slot) && swap_refs[slot] > 0);
+	if (--swap_refs[slot] == 0)
+		bitmap_reset (swap_slots, slot);
+	mutex_release (&swap_lock);
+}
+
+/* Writes out every page queued by anon_swap_out() in slot order, so
+ * a batch of evictions costs one sweep across the swap disk instead
+ * of one seek per page.  The caller must not reuse the frames of
+ * evicted pages before this returns. */
+void
+anon_swap_flush (void) {
+	size_t i, j;
+
+	if (swap_batch_cnt == 0)
+		return;
+
+	/* Insertion sort; batches are small and nearly sorted already. */
+	for (i = 1; i < swap_batch_cnt; i++) {
+		struct swap_write w = swap_batch[i];
+
+		for (j = i; j > 0 && swap_batch[j - 1].slot > w.slot; j--)
+			swap_batch[j] = swap_batch[j - 1];
+		swap_batch[j] = w;
+	}
+
+	for (i = 0; i < swap_batch_cnt; i++) {
+		disk_sector_t sector = swap_batch[i].slot * SECTORS_PER_SLOT;
+		const uint8_t *kva = swap_batch[i].kva;
+
+		for (j = 0; j < SECTORS_PER_SLOT; j++)
+			disk_write (swap_disk, sector + j, kva + j * DISK_SECTOR_SIZE);
+	}
+	swap_out_cnt += swap_batch_cnt;
+	swap_batch_writes++;
+	swap_batch_cnt = 0;
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED, void *kva) {
 	/* Set up the handler */
+	/* Read before the union is overwritten: a page with an init
+	 * callback is filled by it, so zeroing the frame would be wasted.
+	 * KVA is null for a page mapped to the zero frame. */
+	bool zero = page->uninit.init == NULL && kva != NULL;
+
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = BITMAP_ERROR;
+	if (zero)
+		memset (kva, 0, PGSIZE);
+	return true;
+}
+
+/* Makes DST, a new page for the same address in a child process,
+ * an anonymous page with the same contents as SRC.  If SRC is in
+ * swap, the two share its slot. */
+void
+anon_share (struct page *dst, struct page *src) {
+	dst->operations = &anon_ops;
+	dst->anon.slot = src->anon.slot;
+	if (dst->anon.slot != BITMAP_ERROR)
+		swap_slot_get (dst->anon.slot);
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Swap in the page by read contents from the swap disk.
+ * The slot is kept: until the page is written again it still holds
+ * the contents, and evicting it again needs no disk write.  A slot
+ * shared with other pages is never written in place, only replaced,
+ * so this stays true for all of them.  A page with no slot has never
+ * been written, as when it was last mapped to the zero frame, and
+ * reads as zeroes. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	disk_sector_t sector;
+	size_t i;
+
+	if (anon_page->slot == BITMAP_ERROR) {
+		memset (kva, 0, PGSIZE);
+		return true;
+	}
+
+	sector = anon_page->slot * SECTORS_PER_SLOT;
+	for (i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_read (swap_disk, sector + i, (uint8_t *) kva + i * DISK_SECTOR_SIZE);
+	swap_in_cnt++;
+	return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Swap out the page by writing contents to the swap disk.
+ * Saves the frame for every page sharing it after fork, which all
+ * end up referring to the same slot.  The write itself is queued;
+ * the evicting thread issues it with anon_swap_flush() together with
+ * the rest of its batch. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	struct frame *frame = page->frame;
+	size_t slot = page->anon.slot;
+	bool write = slot == BITMAP_ERROR;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *p = list_entry (e, struct page, frame_elem);
+
+		if (p->anon.slot != slot || pml4_is_dirty (p->pml4, p->va))
+			write = true;
+	}
+	if (!write) {
+		swap_clean_cnt++;
+		return true;
+	}
+
+	slot = swap_slot_alloc (frame->ref_cnt);
+	if (slot == BITMAP_ERROR)
+		return false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *p = list_entry (e, struct page, frame_elem);
+
+		if (p->anon.slot != BITMAP_ERROR)
+			swap_slot_put (p->anon.slot);
+		p->anon.slot = slot;
+	}
+
+	if (swap_batch_cnt == SWAP_BATCH)
+		anon_swap_flush ();
+	swap_batch[swap_batch_cnt++] = (struct swap_write) {
+		.slot = slot,
+		.kva = frame->kva,
+	};
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	vm_free_frame (page);
+	if (anon_page->slot != BITMAP_ERROR)
+		swap_slot_put (anon_page->slot);
 }
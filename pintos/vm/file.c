@@ -1,6 +1,12 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <round.h>
+#include <string.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -21,38 +27,291 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
+	/* The segment is still in the uninit half of the union; the init
+	 * callback that loads the page frees it afterwards. */
+	struct file_segment *seg = page->uninit.aux;
+
+	if (seg == NULL)
+		return false;
+
 	/* Set up the handler */
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	file_page->seg = *seg;
+	inode_reopen (file_page->seg.inode);
+	return true;
+}
+
+/* Makes DST, a new page for the same address in a child process, a
+ * page of the same mapping as SRC, which must be a file-backed page.
+ * If SRC is resident, the caller has DST share its frame. */
+void
+file_share (struct page *dst, struct page *src) {
+	dst->operations = &file_ops;
+	dst->file.seg = src->file.seg;
+	inode_reopen (dst->file.seg.inode);
+}
+
+/* Init callback for pages filled from a file on their first fault,
+ * such as the ELF segments load_segment() sets up: fills the page
+ * from AUX, a struct file_segment, and frees it. */
+bool
+file_lazy_load (struct page *page, void *aux) {
+	struct file_segment *seg = aux;
+	bool success = file_segment_load (seg, page->frame->kva);
+
+	file_segment_free (seg);
+	return success;
+}
+
+/* Writes PAGE's frame back to its file. */
+static void
+file_backed_writeback (struct page *page) {
+	struct file_page *file_page = &page->file;
+
+	inode_write_at (file_page->seg.inode, page->frame->kva,
+			file_page->seg.read_bytes, file_page->seg.ofs);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	return file_segment_load (&file_page->seg, kva);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.
+ * After fork, parent and child may map the same frame, which is
+ * written back if either of them modified it.  A clean page is
+ * simply dropped; it can be read again.  Called with the frame
+ * table locked, so the pages mapping the frame cannot change. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct frame *frame = page->frame;
+	bool dirty = false;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *map = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_dirty (map->pml4, map->va)) {
+			pml4_set_dirty (map->pml4, map->va, false);
+			dirty = true;
+		}
+	}
+	if (dirty)
+		file_backed_writeback (page);
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	/* Pinned so that eviction cannot write it back concurrently.  A
+	 * frame still shared with another process is written back now
+	 * too, since the changes may be this page's. */
+	if (vm_pin_dirty (page)) {
+		file_backed_writeback (page);
+		vm_unpin_page (page);
+	}
+	vm_free_frame (page);
+	inode_close (file_page->seg.inode);
 }
 
-/* Do the mmap */
+/* Do the mmap
+ * Maps LENGTH bytes of FILE from OFFSET at ADDR.  Pages are read
+ * on first access; the part of the last page past the end of the
+ * file reads as zeroes and is never written back.  Returns ADDR, or
+ * a null pointer if the arguments are bad or the range overlaps
+ * existing pages.
+ * The pages map the page cache's frames, so that every process
+ * mapping the file, and read() and write(), share one copy. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region;
+	size_t page_cnt, i;
+	off_t file_len;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0)
+		return NULL;
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	if ((uint64_t) addr + page_cnt * PGSIZE < (uint64_t) addr
+			|| !is_user_vaddr ((uint8_t *) addr + page_cnt * PGSIZE - 1))
+		return NULL;
+	file_len = file_length (file);
+	if (file_len == 0)
+		return NULL;
+	for (i = 0; i < page_cnt; i++)
+		if (spt_find_page (spt, (uint8_t *) addr + i * PGSIZE) != NULL)
+			return NULL;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->file = file_reopen (file);
+	if (region->file == NULL) {
+		free (region);
+		return NULL;
+	}
+	region->addr = addr;
+	region->page_cnt = page_cnt;
+
+	for (i = 0; i < page_cnt; i++) {
+		off_t ofs = offset + i * PGSIZE;
+		size_t read_bytes = ofs < file_len ? file_len - ofs : 0;
+		struct file_segment *seg;
+
+		if (read_bytes > PGSIZE)
+			read_bytes = PGSIZE;
+		seg = file_segment_create (region->file, ofs, read_bytes);
+		if (seg == NULL
+				|| !vm_alloc_page_with_initializer (VM_PAGE_CACHE,
+					(uint8_t *) addr + i * PGSIZE, writable, NULL, seg)) {
+			file_segment_free (seg);
+			region->page_cnt = i;
+			mmap_region_free (spt, region);
+			return NULL;
+		}
+	}
+	list_push_back (&spt->mmaps, &region->elem);
+	return addr;
 }
 
-/* Do the munmap */
+/* Do the munmap
+ * The region's pages are unmapped under one TLB gather, so that a
+ * large region costs one flush instead of an invlpg per page. */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->mmaps); e != list_end (&spt->mmaps);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+
+		if (region->addr == addr) {
+			struct tlb_gather tlb;
+
+			list_remove (&region->elem);
+			tlb_gather_begin (&tlb);
+			mmap_region_free (spt, region);
+			tlb_gather_end (&tlb);
+			return;
+		}
+	}
+}
+
+/* Removes the pages of REGION from SPT, writing back the dirty
+ * ones, and frees REGION. */
+void
+mmap_region_free (struct supplemental_page_table *spt,
+		struct mmap_region *region) {
+	size_t i;
+
+	for (i = 0; i < region->page_cnt; i++) {
+		struct page *page = spt_find_page (spt,
+				(uint8_t *) region->addr + i * PGSIZE);
+
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+	file_close (region->file);
+	free (region);
+}
+
+/* Gives the process owning DST a copy of each mapping in SRC.  The
+ * pages themselves are copied with the rest of the SPT. */
+bool
+mmap_regions_copy (struct list *dst, struct list *src) {
+	struct list_elem *e;
+
+	for (e = list_begin (src); e != list_end (src); e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		struct mmap_region *copy = malloc (sizeof *copy);
+
+		if (copy == NULL)
+			return false;
+		*copy = *region;
+		copy->file = file_reopen (region->file);
+		if (copy->file == NULL) {
+			free (copy);
+			return false;
+		}
+		list_push_back (dst, &copy->elem);
+	}
+	return true;
+}
+
+/* Returns a segment that reads READ_BYTES bytes of FILE from OFS,
+ * or a null pointer if memory is exhausted. */
+struct file_segment *
+file_segment_create (struct file *file, off_t ofs, size_t read_bytes) {
+	struct file_segment *seg;
+
+	ASSERT (read_bytes <= PGSIZE);
+
+	seg = malloc (sizeof *seg);
+	if (seg != NULL) {
+		seg->inode = inode_reopen (file_get_inode (file));
+		seg->ofs = ofs;
+		seg->read_bytes = read_bytes;
+	}
+	return seg;
+}
+
+/* Returns a copy of SEG with its own inode reference, or a null
+ * pointer if memory is exhausted. */
+struct file_segment *
+file_segment_dup (const struct file_segment *seg) {
+	struct file_segment *copy = malloc (sizeof *copy);
+
+	if (copy != NULL) {
+		*copy = *seg;
+		inode_reopen (copy->inode);
+	}
+	return copy;
+}
+
+/* Drops SEG's inode reference and frees it. */
+void
+file_segment_free (struct file_segment *seg) {
+	if (seg != NULL) {
+		inode_close (seg->inode);
+		free (seg);
+	}
+}
+
+/* Fills the page at KVA from SEG.  Returns true if the whole
+ * segment could be read. */
+bool
+file_segment_load (const struct file_segment *seg, void *kva) {
+	off_t read_bytes = seg->read_bytes;
+
+	if (inode_read_at (seg->inode, kva, read_bytes, seg->ofs) != read_bytes)
+		return false;
+	memset ((uint8_t *) kva + read_bytes, 0, PGSIZE - read_bytes);
+	return true;
+}
+
+/* Returns true if file_segment_load() on SEG would find all of its
+ * data in the buffer cache. */
+bool
+file_segment_is_cached (const struct file_segment *seg) {
+	return inode_is_cached (seg->inode, seg->read_bytes, seg->ofs);
+}
+
+/* Starts reading SEG into the buffer cache, without waiting. */
+void
+file_segment_prefetch (const struct file_segment *seg) {
+	inode_prefetch (seg->inode, seg->read_bytes, seg->ofs);
 }
@@ -1,9 +1,90 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Supplemental page table statistics, summed over all processes.
+ * Updated with atomic operations because SPTs of processes on
+ * different CPUs change concurrently. */
+static size_t spt_page_cnt;     /* Pages currently tracked. */
+static size_t spt_page_peak;    /* Maximum of spt_page_cnt. */
+static size_t spt_bucket_cnt;   /* Hash buckets currently allocated. */
+static size_t spt_bucket_peak;  /* Maximum of spt_bucket_cnt. */
+
+static uint64_t spt_hash (const struct hash_elem *, void *);
+static bool spt_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static void spt_account (struct supplemental_page_table *, size_t old_buckets,
+		int page_delta);
+
+/* Frame table: every frame handed out from the user pool, in clock
+ * order.  FRAME_LOCK protects the list, the clock hand, every
+ * frame's PAGE and PINNED members and the statistics below.  It is
+ * held across the swap-out of a victim, so a fault on a page that
+ * is being evicted waits in vm_get_frame() until the page is out.
+ *
+ * Under EVICT_WSCLOCK, FRAME_TABLE holds only the active frames, and
+ * new frames start out on INACTIVE_FRAMES until they are seen used
+ * twice, so that pages touched once by a sequential scan are evicted
+ * before they can push out the working set. */
+static struct list frame_table;
+static struct list inactive_frames;
+static struct list_elem *clock_hand;
+static struct lock frame_lock;
+
+static long long evict_cnt;        /* Frames evicted. */
+static long long evict_clean_cnt;  /* ...whose page was not dirty. */
+static long long evict_scan_cnt;   /* Frames looked at to find victims. */
+static long long promote_cnt;      /* Inactive frames made active. */
+
+/* -evict=POLICY: how vm_get_victim() chooses frames to evict. */
+enum evict_policy vm_evict_policy = EVICT_WSCLOCK;
+static const char *policies[] = { "fifo", "clock", "wsclock" };
+
+/* -huge: map aligned 2 MB anonymous regions with huge pages. */
+bool vm_huge_pages;
+
+/* WSClock's working-set window, in ticks of its owner's virtual
+ * time: an active frame unused for longer has left the working set. */
+#define WS_TAU (TIMER_FREQ / 2)
+
+static long long cow_share_cnt;    /* Frames shared by fork. */
+static long long cow_copy_cnt;     /* Write faults that copied a frame. */
+static long long cow_reuse_cnt;    /* ...that found the frame unshared. */
+
+/* A page of zeroes, mapped read-only in place of a frame of its own
+ * by every anonymous page that has been read but never written.  It
+ * is not in the frame table, so it is never evicted or freed.  Its
+ * PAGES and REF_CNT are protected by frame_lock like any frame's. */
+static struct frame zero_frame;
+
+static long long zero_map_cnt;     /* Read faults given the zero frame. */
+static long long zero_copy_cnt;    /* ...later written to. */
+
+static long long huge_map_cnt;     /* Huge pages mapped. */
+
+static long long around_map_cnt;   /* Pages mapped by fault-around. */
+static long long around_fetch_cnt; /* ...and prefetched instead. */
+
+/* -stack=SIZE: most bytes the user stack may grow to. */
+size_t vm_stack_limit = 1 << 20;
+
+/* Most stack pages claimed ahead of a growth fault. */
+#define STACK_GROW_AHEAD 16
+
+/* Size of the aligned window of pages that fault-around looks at. */
+#define FAULT_AROUND_PAGES 16
+
+/* Most victims taken by one call to vm_evict_frame(). */
+#define EVICT_BATCH 8
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
@@ -15,7 +96,49 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&frame_table);
+	list_init (&inactive_frames);
+	clock_hand = list_end (&frame_table);
+	lock_init (&frame_lock);
+
+	zero_frame.kva = palloc_get_page (PAL_ZERO);
+	if (zero_frame.kva == NULL)
+		PANIC ("out of memory for zero frame");
+	zero_frame.page = NULL;
+	list_init (&zero_frame.pages);
+	zero_frame.ref_cnt = 0;
+	zero_frame.pin_cnt = 1;
+
+#ifndef EFILESYS
+	/* File data goes through the page cache in this kernel too. */
+	pagecache_init ();
+#endif
+}
+
+/* Prints virtual memory statistics.  The per-page cost is the
+ * struct page itself plus its share of the hash buckets, both
+ * taken at the point where the most pages were tracked. */
+void
+vm_print_stats (void) {
+	size_t pages = spt_page_peak;
+	size_t bucket_bytes = spt_bucket_peak * sizeof (struct list);
+
+	printf ("SPT: %zu pages at peak, %zu bytes/page (%zu page + %zu buckets)\n",
+			pages, sizeof (struct page) + (pages ? bucket_bytes / pages : 0),
+			sizeof (struct page), pages ? bucket_bytes / pages : 0);
+	printf ("Frames: %s, %lld evictions (%lld clean, %lld dirty), "
+			"%lld frames scanned, %lld promoted\n",
+			policies[vm_evict_policy], evict_cnt, evict_clean_cnt,
+			evict_cnt - evict_clean_cnt, evict_scan_cnt, promote_cnt);
+	printf ("COW: %lld pages shared, %lld copied, %lld reused\n",
+			cow_share_cnt, cow_copy_cnt, cow_reuse_cnt);
+	printf ("Zero frame: %lld pages mapped, %lld written\n",
+			zero_map_cnt, zero_copy_cnt);
+	printf ("Huge pages: %lld mapped\n", huge_map_cnt);
+	printf ("Fault-around: %lld pages mapped, %lld prefetched\n",
+			around_map_cnt, around_fetch_cnt);
+	anon_print_stats ();
+	page_cache_print_stats ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,7 +158,17 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool vm_claim_pinned (struct page *page);
+static bool vm_claim_frame (struct page *page, struct frame *frame);
+static const struct file_segment *page_file_segment (struct page *page);
+static void vm_fault_around (struct page *page);
+static void frame_release (struct page *page, bool unpin);
+static bool vm_share_page (struct supplemental_page_table *,
+		struct page *src);
 static struct frame *vm_evict_frame (void);
+static struct frame *frame_new (void *kva);
+static struct frame *frame_alloc (void);
+static struct frame *vm_try_get_frame (void);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -50,11 +183,36 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			case VM_PAGE_CACHE:
+				initializer = page_cache_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, pg_round_down (upage), init, type, aux, initializer);
+		page->pml4 = thread_current ()->pml4;
+		page->owner = thread_current ();
+		page->writable = writable;
 
-		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,81 +220,851 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	size_t old_buckets = spt->pages.bucket_cnt;
 
-	return succ;
+	ASSERT (pg_ofs (page->va) == 0);
+
+	if (hash_insert (&spt->pages, &page->spt_elem) != NULL)
+		return false;
+	spt_account (spt, old_buckets, 1);
+	return true;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	size_t old_buckets = spt->pages.bucket_cnt;
+
+	hash_delete (&spt->pages, &page->spt_elem);
+	spt_account (spt, old_buckets, -1);
 	vm_dealloc_page (page);
+}
+
+/* Returns a hash value for the page that E belongs to. */
+static uint64_t
+spt_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *page = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&page->va, sizeof page->va);
+}
+
+/* Returns true if the page for A precedes the page for B. */
+static bool
+spt_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	const struct page *pa = hash_entry (a, struct page, spt_elem);
+	const struct page *pb = hash_entry (b, struct page, spt_elem);
+	return pa->va < pb->va;
+}
+
+/* Records that SPT gained (PAGE_DELTA > 0) or lost pages, and that
+ * its hash table had OLD_BUCKETS buckets before the change. */
+static void
+spt_account (struct supplemental_page_table *spt, size_t old_buckets,
+		int page_delta) {
+	size_t pages, buckets;
+
+	pages = __atomic_add_fetch (&spt_page_cnt, page_delta, __ATOMIC_RELAXED);
+	buckets = __atomic_add_fetch (&spt_bucket_cnt,
+			spt->pages.bucket_cnt - old_buckets, __ATOMIC_RELAXED);
+	/* Racy, but only ever off by a concurrent update. */
+	if (pages > spt_page_peak) {
+		spt_page_peak = pages;
+		spt_bucket_peak = buckets;
+	}
+}
+
+/* Returns the frame after E in clock order, wrapping around. */
+static struct list_elem *
+clock_next (struct list_elem *e) {
+	e = list_next (e);
+	return e != list_end (&frame_table) ? e : list_begin (&frame_table);
+}
+
+/* Adds PAGE to the pages that map FRAME. */
+static void
+frame_attach (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->ref_cnt++;
+	frame->page = list_entry (list_front (&frame->pages), struct page,
+			frame_elem);
+	page->frame = frame;
+}
+
+/* Removes PAGE from the pages that map its frame and returns the
+ * number of pages left. */
+static unsigned
+frame_detach (struct page *page) {
+	struct frame *frame = page->frame;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	list_remove (&page->frame_elem);
+	page->frame = NULL;
+	frame->page = list_empty (&frame->pages) ? NULL
+		: list_entry (list_front (&frame->pages), struct page, frame_elem);
+	return --frame->ref_cnt;
+}
+
+/* Returns true if any page mapping FRAME was accessed, clearing the
+ * accessed bits as it goes.  Only done to evictable frames, which
+ * are out of any huge page, so one page's bit is never another's.
+ * Here and below, a page with no PML4 is the kernel's own and is
+ * never mapped. */
+static bool
+frame_test_and_clear_accessed (struct frame *frame) {
+	bool accessed = false;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (page->pml4 != NULL && pml4_is_accessed (page->pml4, page->va)) {
+			pml4_set_accessed (page->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if FRAME is shared copy-on-write.  Other shared
+ * frames, such as the page cache's and those of a file mapping
+ * inherited by fork, are written in place. */
+static bool
+frame_is_cow (struct frame *frame) {
+	return frame->ref_cnt > 1
+		&& VM_TYPE (frame->page->operations->type) == VM_ANON;
+}
+
+/* Returns true if any page mapping FRAME is dirty. */
+static bool
+frame_is_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (page->pml4 != NULL && pml4_is_dirty (page->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+/* Returns the virtual time of the process that FRAME's pages belong
+ * to: the ticks it has spent running user code.  A frame only the
+ * kernel uses, such as an unmapped page cache page, ages in real
+ * time instead. */
+static int64_t
+frame_vtime (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (page->owner != NULL)
+			return page->owner->vtime;
+	}
+	return timer_ticks ();
+}
+
+/* Gives each page mapping FRAME, which was mapped as part of a huge
+ * page, a PTE of its own.  Returns false if there is no memory to
+ * split the huge page. */
+static bool
+frame_split_huge (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (page->pml4 != NULL && !pml4_split_huge_page (page->pml4, page->va))
+			return false;
+	}
+	frame->huge = false;
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns true if FRAME may be evicted at all.  A frame mapped as
+ * part of a huge page is first split out of it, so that it can be
+ * looked at and unmapped on its own; until there is memory for
+ * that, it stays put. */
+static bool
+frame_evictable (struct frame *frame) {
+	if (frame->pin_cnt != 0 || frame->ref_cnt == 0)
+		return false;
+	return !frame->huge || frame_split_huge (frame);
+}
+
+/* FIFO: the frame that has held its page the longest. */
 static struct frame *
-vm_get_victim (void) {
+fifo_get_victim (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame_table); e != list_end (&frame_table);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+
+		evict_scan_cnt++;
+		if (frame_evictable (frame))
+			return frame;
+	}
+	return NULL;
+}
+
+/* Second-chance clock that prefers clean pages: the hand clears the
+ * accessed bit of each frame it passes, and takes the first frame
+ * that is neither accessed nor dirty.  Dirty, unaccessed frames are
+ * remembered on the first lap and used if no clean frame shows up
+ * before the hand has gone around twice, which is enough to see every
+ * accessed bit cleared once.  A shared frame counts as accessed or
+ * dirty if any of its pages is. */
+static struct frame *
+clock_get_victim (void) {
 	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	struct frame *dirty = NULL;
+	size_t i, n = list_size (&frame_table);
+
+	if (clock_hand == list_end (&frame_table))
+		clock_hand = list_begin (&frame_table);
+	for (i = 0; i < 2 * n && victim == NULL; i++) {
+		struct frame *frame = list_entry (clock_hand, struct frame, elem);
+
+		clock_hand = clock_next (clock_hand);
+		evict_scan_cnt++;
+		if (!frame_evictable (frame))
+			continue;
+		if (frame_test_and_clear_accessed (frame))
+			continue;
+		else if (!frame_is_dirty (frame))
+			victim = frame;
+		else if (dirty == NULL)
+			dirty = frame;
+	}
+	return victim != NULL ? victim : dirty;
+}
+
+/* WSClock over two lists.
+ *
+ * The inactive list is looked at first, front to back.  A frame used
+ * since the last look gets a second chance the first time and is
+ * promoted to the active list the second; an unused clean frame is
+ * taken at once.  Only when the inactive list has nothing to give
+ * does the hand sweep the active list, where each used frame's
+ * LAST_USE is brought up to its owner's virtual time, and a clean
+ * frame unused for more than WS_TAU of that time has dropped out of
+ * the working set and is taken.  Failing all that, the first dirty
+ * candidate seen is used, and then the active frame unused longest. */
+static struct frame *
+wsclock_get_victim (void) {
+	struct frame *dirty = NULL;
+	struct frame *oldest = NULL;
+	int64_t oldest_age = -1;
+	size_t i, n;
+
+	n = list_size (&inactive_frames);
+	for (i = 0; i < n; i++) {
+		struct frame *frame = list_entry (list_pop_front (&inactive_frames),
+				struct frame, elem);
+
+		evict_scan_cnt++;
+		if (!frame_evictable (frame))
+			list_push_back (&inactive_frames, &frame->elem);
+		else if (frame_test_and_clear_accessed (frame)) {
+			if (frame->referenced) {
+				frame->active = true;
+				frame->last_use = frame_vtime (frame);
+				list_push_back (&frame_table, &frame->elem);
+				promote_cnt++;
+			} else {
+				frame->referenced = true;
+				list_push_back (&inactive_frames, &frame->elem);
+			}
+		} else {
+			list_push_back (&inactive_frames, &frame->elem);
+			if (!frame_is_dirty (frame))
+				return frame;
+			else if (dirty == NULL)
+				dirty = frame;
+		}
+	}
+
+	if (clock_hand == list_end (&frame_table))
+		clock_hand = list_begin (&frame_table);
+	n = list_size (&frame_table);
+	for (i = 0; i < 2 * n; i++) {
+		struct frame *frame = list_entry (clock_hand, struct frame, elem);
+		int64_t age;
+
+		clock_hand = clock_next (clock_hand);
+		evict_scan_cnt++;
+		if (!frame_evictable (frame))
+			continue;
+		if (frame_test_and_clear_accessed (frame)) {
+			frame->last_use = frame_vtime (frame);
+			continue;
+		}
+		age = frame_vtime (frame) - frame->last_use;
+		if (age > WS_TAU) {
+			if (!frame_is_dirty (frame))
+				return frame;
+			else if (dirty == NULL)
+				dirty = frame;
+		}
+		if (age > oldest_age) {
+			oldest = frame;
+			oldest_age = age;
+		}
+	}
+	return dirty != NULL ? dirty : oldest;
+}
+
+/* Get the struct frame, that will be evicted, as chosen by
+ * vm_evict_policy. */
+static struct frame *
+vm_get_victim (void) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
 
-	return victim;
+	switch (vm_evict_policy) {
+		case EVICT_FIFO:
+			return fifo_get_victim ();
+		case EVICT_CLOCK:
+			return clock_get_victim ();
+		case EVICT_WSCLOCK:
+		default:
+			return wsclock_get_victim ();
+	}
+}
+
+/* Adds FRAME, which is in no list, to the frame table.  Under
+ * EVICT_WSCLOCK it starts out inactive. */
+static void
+frame_table_insert (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	frame->active = vm_evict_policy != EVICT_WSCLOCK;
+	frame->referenced = false;
+	frame->last_use = 0;
+	list_push_back (frame->active ? &frame_table : &inactive_frames,
+			&frame->elem);
+}
+
+/* Removes FRAME from the frame table. */
+static void
+frame_table_remove (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	list_remove (&frame->elem);
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.
+ *
+ * Running out of frames usually means more evictions are coming, so
+ * up to EVICT_BATCH victims are taken at once.  They are all
+ * unmapped under one TLB gather before any is saved, and their swap
+ * writes go out together in anon_swap_flush(); the first frame is
+ * returned and the rest go back to the user pool for the next few
+ * allocations. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct frame *victims[EVICT_BATCH];
+	struct tlb_gather tlb;
+	size_t i, n = 0;
 
-	return NULL;
+	/* Unmap first so the owners fault, and then wait on FRAME_LOCK,
+	 * instead of writing to the pages while they are being saved.
+	 * An owner running on another CPU would go on writing through its
+	 * TLB, so the gather's end shoots the stale translations down
+	 * there too before anything is saved.  The dirty bits survive in
+	 * the cleared PTEs for swap_out() to see after that. */
+	tlb_gather_begin (&tlb);
+	while (n < EVICT_BATCH) {
+		struct frame *victim = vm_get_victim ();
+		struct list_elem *e;
+
+		if (victim == NULL)
+			break;
+		for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+			if (page->pml4 != NULL)
+				pml4_clear_page (page->pml4, page->va);
+		}
+		victim->pin_cnt++;
+		victims[n++] = victim;
+	}
+	tlb_gather_end (&tlb);
+
+	/* swap_out() on the first page saves the frame for all of them.
+	 * If it fails, the victims not yet saved are mapped back. */
+	for (i = 0; i < n; i++) {
+		struct frame *victim = victims[i];
+		bool dirty = frame_is_dirty (victim);
+
+		if (!swap_out (victim->page))
+			break;
+		if (!dirty)
+			evict_clean_cnt++;
+		evict_cnt++;
+
+		while (!list_empty (&victim->pages))
+			frame_detach (list_entry (list_front (&victim->pages), struct page,
+						frame_elem));
+	}
+	anon_swap_flush ();
+
+	while (n > i) {
+		struct frame *victim = victims[--n];
+		struct list_elem *e;
+
+		for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+			if (page->pml4 != NULL)
+				pml4_set_page (page->pml4, page->va, victim->kva,
+						page->writable && !frame_is_cow (victim));
+		}
+		victim->pin_cnt--;
+	}
+
+	if (n == 0)
+		return NULL;
+	for (i = 1; i < n; i++) {
+		frame_table_remove (victims[i]);
+		palloc_free_page (victims[i]->kva);
+		free (victims[i]);
+	}
+	return victims[0];
+}
+
+/* Returns a new, pinned frame for KVA, a page from the user pool,
+ * and adds it to the frame table. */
+static struct frame *
+frame_new (void *kva) {
+	struct frame *frame;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	frame = malloc (sizeof *frame);
+	if (frame == NULL)
+		PANIC ("out of memory for frame table");
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->ref_cnt = 0;
+	frame->pin_cnt = 1;
+	frame->huge = false;
+	frame_table_insert (frame);
+	return frame;
+}
+
+/* Returns a new, pinned frame from the user pool, or a null pointer
+ * if the pool is empty. */
+static struct frame *
+frame_alloc (void) {
+	void *kva;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	kva = palloc_get_page (PAL_USER);
+	return kva != NULL ? frame_new (kva) : NULL;
+}
+
+/* Like vm_get_frame(), but returns a null pointer instead of
+ * evicting anything if the user pool is empty. */
+static struct frame *
+vm_try_get_frame (void) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = frame_alloc ();
+	lock_release (&frame_lock);
+	return frame;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space.
+ * The frame comes back pinned; the caller unpins it once the page
+ * it is for is mapped. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = frame_alloc ();
+	if (frame == NULL) {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			PANIC ("out of user frames and nothing to evict");
+		/* Its new page starts over at the back. */
+		frame_table_remove (frame);
+		frame_table_insert (frame);
+	}
+	lock_release (&frame_lock);
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Drops a pin on FRAME. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+frame_unpin (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0);
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
+
+/* Returns true if a fault at ADDR, with the user stack pointer at
+ * RSP, is the stack growing: at most 8 bytes below RSP (a PUSH or
+ * CALL) and within vm_stack_limit of USER_STACK. */
+static bool
+vm_is_stack_access (void *addr, uint64_t rsp) {
+	uint64_t va = (uint64_t) addr;
+
+	return va < USER_STACK && va >= USER_STACK - vm_stack_limit
+		&& va + 8 >= rsp;
+}
+
+/* Growing the stack.
+ * Every page between ADDR and the current bottom of the stack is
+ * added, top down, so that the bottom only ever moves past pages that
+ * were added and the stack has no holes if one cannot be.  A function
+ * that drops RSP by many pages at once is about to use them, so up to
+ * STACK_GROW_AHEAD of those above ADDR are claimed right away instead
+ * of taking a fault each. */
+static void
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *bottom = pg_round_down (addr);
+	uint8_t *upage;
+
+	for (upage = spt->stack_bottom; upage > bottom; ) {
+		upage -= PGSIZE;
+		if (!vm_alloc_page (VM_ANON, upage, true))
+			break;
+		spt->stack_bottom = upage;
+	}
+
+	for (upage = bottom + PGSIZE;
+			upage < bottom + STACK_GROW_AHEAD * PGSIZE; upage += PGSIZE) {
+		struct page *page = spt_find_page (spt, upage);
+
+		if (page == NULL || page->frame != NULL || !vm_do_claim_page (page))
+			break;
+	}
+}
+
+/* Returns true if PAGE is an anonymous page that has never been
+ * touched and has no contents to load, so it is all zeroes. */
+static bool
+vm_is_zero_fill (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL;
+}
+
+/* Turns PAGE, for which vm_is_zero_fill() is true, into an
+ * anonymous page mapped read-only to the zero frame.  Its first
+ * write faults into vm_handle_wp(), which gives it a frame of its
+ * own; until then it costs no frame and no zeroing. */
+static bool
+vm_map_zero (struct page *page) {
+	bool success;
+
+	/* A null KVA tells the initializer there is no frame to clear. */
+	if (!swap_in (page, NULL))
+		return false;
+
+	lock_acquire (&frame_lock);
+	success = pml4_set_page (page->pml4, page->va, zero_frame.kva, false);
+	if (success) {
+		frame_attach (&zero_frame, page);
+		zero_map_cnt++;
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Huge pages.  With -huge, a fault in an aligned 2 MB stretch of
+ * writable anonymous pages that are all still unclaimed and zeroed,
+ * such as part of a large array in the bss, is served by 512
+ * physically contiguous frames mapped with one huge page, which
+ * costs one TLB entry and no page table.  Each frame remains the
+ * ordinary frame of its own page, so eviction, copy-on-write and
+ * exit go on working a page at a time: eviction and fork split the
+ * huge page before they touch one page of it, and back off if there
+ * is no memory for that, while exit unmaps it whole if it must (see
+ * pml4_clear_page()).  Returns
+ * false, having changed nothing that matters, if PAGE's stretch does
+ * not qualify or no aligned block is free; nothing is evicted for
+ * one. */
+static bool
+vm_map_huge (struct page *page) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	const size_t cnt = HPGSIZE / PGSIZE;
+	uint8_t *base = (uint8_t *) ((uintptr_t) page->va & ~HPGMASK);
+	uint8_t *kva;
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		if (p == NULL || !p->writable || !vm_is_zero_fill (p))
+			return false;
+	}
+	kva = palloc_get_aligned (PAL_USER | PAL_ZERO, cnt, cnt);
+	if (kva == NULL)
+		return false;
+
+	/* A null KVA tells the initializer the frame is already clear. */
+	lock_acquire (&frame_lock);
+	for (i = 0; i < cnt; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		frame_attach (frame_new (kva + i * PGSIZE), p);
+		swap_in (p, NULL);
+	}
+	lock_release (&frame_lock);
+
+	if (!pml4_set_huge_page (page->pml4, base, kva, true)) {
+		/* The pages are plain anonymous pages now, zeroed when they
+		 * are next claimed. */
+		for (i = 0; i < cnt; i++)
+			frame_release (spt_find_page (spt, base + i * PGSIZE), true);
+		return false;
+	}
+	for (i = 0; i < cnt; i++) {
+		struct frame *frame = spt_find_page (spt, base + i * PGSIZE)->frame;
+		frame->huge = true;
+		frame_unpin (frame);
+	}
+	__atomic_add_fetch (&huge_map_cnt, 1, __ATOMIC_RELAXED);
+	return true;
 }
 
-/* Handle the fault on write_protected page */
+/* Handle the fault on write_protected page
+ *
+ * A writable page is only mapped read-only while its frame is shared
+ * with another process after fork, or while it is mapped to the zero
+ * frame.  The last page left on a frame simply gets write access
+ * back; the others take a private copy. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *old, *new;
+
+	if (!page->writable)
+		return false;
+
+	lock_acquire (&frame_lock);
+	old = page->frame;
+	if (old == NULL) {
+		/* Evicted since the fault was taken. */
+		lock_release (&frame_lock);
+		return vm_do_claim_page (page);
+	}
+	if (old->ref_cnt == 1 && old != &zero_frame) {
+		pml4_set_writable (page->pml4, page->va, true);
+		cow_reuse_cnt++;
+		lock_release (&frame_lock);
+		return true;
+	}
+	old->pin_cnt++;
+	lock_release (&frame_lock);
+
+	new = vm_get_frame ();
+	if (old == &zero_frame)
+		memset (new->kva, 0, PGSIZE);
+	else
+		memcpy (new->kva, old->kva, PGSIZE);
+
+	lock_acquire (&frame_lock);
+	old->pin_cnt--;
+	if (frame_detach (page) == 0 && old != &zero_frame) {
+		/* The other pages went away while we were copying. */
+		frame_table_remove (old);
+		palloc_free_page (old->kva);
+		free (old);
+	}
+	frame_attach (new, page);
+	if (old == &zero_frame)
+		zero_copy_cnt++;
+	else
+		cow_copy_cnt++;
+	lock_release (&frame_lock);
+
+	/* The copy may differ from what the page's swap slot holds, so
+	 * mark it dirty for the next eviction to write it out. */
+	pml4_clear_page (page->pml4, page->va);
+	if (!pml4_set_page (page->pml4, page->va, new->kva, true)) {
+		frame_unpin (new);
+		return false;
+	}
+	pml4_set_dirty (page->pml4, page->va, true);
+	frame_unpin (new);
+	return true;
+}
+
+/* Returns the part of a file that PAGE, which is not resident, will
+ * be read from when it is claimed, or a null pointer if it is not
+ * read from a file. */
+static const struct file_segment *
+page_file_segment (struct page *page) {
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			/* Null for a page that starts out zeroed. */
+			return page->uninit.aux;
+		case VM_FILE:
+			return &page->file.seg;
+		case VM_PAGE_CACHE:
+			return &page->page_cache.seg;
+		default:
+			return NULL;
+	}
+}
+
+/* Starts reading PAGE_CNT pages of the file SEG is part of, from SEG
+ * on, into the cache that a page of type TYPE is read through. */
+static void
+vm_prefetch (enum vm_type type, const struct file_segment *seg,
+		size_t page_cnt) {
+	__atomic_add_fetch (&around_fetch_cnt, page_cnt, __ATOMIC_RELAXED);
+	if (type == VM_PAGE_CACHE) {
+		page_cache_prefetch (seg, page_cnt);
+		return;
+	}
+	file_segment_prefetch (seg);
+}
+
+/* Fault-around.  After a read fault has brought in PAGE, which comes
+ * from a file, maps the other non-resident file pages in the aligned
+ * window of FAULT_AROUND_PAGES pages around it whose data is already
+ * in memory, so that a process running through its code or a mapped
+ * file takes one fault per window instead of one per page.  The data
+ * of the rest is prefetched, so that their own faults will not wait
+ * for the disk.
+ *
+ * Pages of the page cache come from the cache's own frames, and
+ * contiguous runs of them are prefetched with one request.  Other
+ * pages are read through the buffer cache into free frames: nothing
+ * is evicted for a page that was not asked for, so fault-around stops
+ * when the user pool runs dry.  Pages mapped this way have their
+ * accessed bits clear and are the first to go if they are not used. */
+static void
+vm_fault_around (struct page *page) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	const uintptr_t window = FAULT_AROUND_PAGES * PGSIZE;
+	uint8_t *start = (uint8_t *) ((uintptr_t) page->va & ~(window - 1));
+	struct file_segment run;        /* First page of pending prefetch. */
+	enum vm_type run_type = VM_UNINIT;
+	size_t run_cnt = 0;
+	uint8_t *va;
+
+	for (va = start; va < start + window && is_user_vaddr (va);
+			va += PGSIZE) {
+		struct page *p = spt_find_page (spt, va);
+		const struct file_segment *seg;
+		enum vm_type type;
+		struct frame *frame;
+		bool cached;
+
+		/* Only this thread makes its pages resident, so a page seen
+		 * without a frame here keeps it that way until claimed. */
+		if (p == NULL || p == page || p->frame != NULL)
+			continue;
+		seg = page_file_segment (p);
+		if (seg == NULL)
+			continue;
+		type = page_get_type (p);
+		if (type == VM_PAGE_CACHE)
+			cached = page_cache_is_resident (seg);
+		else
+			cached = file_segment_is_cached (seg);
+
+		if (!cached) {
+			if (run_cnt > 0 && type == run_type && seg->inode == run.inode
+					&& seg->ofs == run.ofs + (off_t) (run_cnt * PGSIZE)) {
+				run_cnt++;
+				continue;
+			}
+			if (run_cnt > 0)
+				vm_prefetch (run_type, &run, run_cnt);
+			run = *seg;
+			run_type = type;
+			run_cnt = 1;
+			continue;
+		}
+
+		if (type == VM_PAGE_CACHE)
+			frame = page_cache_get_frame (p);
+		else
+			frame = vm_try_get_frame ();
+		if (frame == NULL || !vm_claim_frame (p, frame))
+			break;
+		frame_unpin (frame);
+		__atomic_add_fetch (&around_map_cnt, 1, __ATOMIC_RELAXED);
+	}
+	if (run_cnt > 0)
+		vm_prefetch (run_type, &run, run_cnt);
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (page == NULL) {
+		/* In the kernel, F->rsp is the kernel stack; use the user rsp
+		 * saved on entry to the system call instead. */
+		uint64_t rsp = user ? f->rsp : thread_current ()->user_rsp;
 
+		if (!not_present || !vm_is_stack_access (addr, rsp))
+			return false;
+		vm_stack_growth (addr);
+		page = spt_find_page (spt, addr);
+		if (page == NULL)
+			return false;
+	}
+	if (!not_present)
+		return write && vm_handle_wp (page);
+	if (write && !page->writable)
+		return false;
+
+	if (vm_huge_pages && vm_is_zero_fill (page) && vm_map_huge (page))
+		return true;
+	if (!write && vm_is_zero_fill (page))
+		return vm_map_zero (page);
+	if (!write && page_file_segment (page) != NULL) {
+		if (!vm_do_claim_page (page))
+			return false;
+		vm_fault_around (page);
+		return true;
+	}
 	return vm_do_claim_page (page);
 }
 
@@ -150,41 +1078,334 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	if (!vm_claim_pinned (page))
+		return false;
+	frame_unpin (page->frame);
+	return true;
+}
+
+/* Like vm_do_claim_page(), but leaves the frame pinned. */
+static bool
+vm_claim_pinned (struct page *page) {
+	struct frame *frame;
+
+	/* A process's mapping of a cached file page shares the frame of
+	 * the page cache, which comes back filled and pinned. */
+	if (page->pml4 != NULL && page_get_type (page) == VM_PAGE_CACHE)
+		frame = page_cache_get_frame (page);
+	else
+		frame = vm_get_frame ();
+	if (frame == NULL)
+		return false;
+	return vm_claim_frame (page, frame);
+}
 
+/* Makes PAGE resident in FRAME, which the caller has pinned, and
+ * maps it.  The frame stays pinned. */
+static bool
+vm_claim_frame (struct page *page, struct frame *frame) {
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	lock_acquire (&frame_lock);
+	frame_attach (frame, page);
+	lock_release (&frame_lock);
+
+	/* Fill the frame before the mapping makes it visible. */
+	if (!swap_in (page, frame->kva)
+			|| (page->pml4 != NULL
+				&& !pml4_set_page (page->pml4, page->va, frame->kva,
+					page->writable))) {
+		frame_release (page, true);
+		return false;
+	}
+	return true;
+}
+
+/* Makes PAGE resident, bringing it back in if it was evicted, and
+ * pins its frame.  Used when the kernel needs the contents of a page
+ * that is not mapped in the running address space. */
+bool
+vm_pin_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL) {
+		page->frame->pin_cnt++;
+		lock_release (&frame_lock);
+		return true;
+	}
+	lock_release (&frame_lock);
+	return vm_claim_pinned (page);
+}
+
+/* Pins PAGE's frame if it has one.  Returns true if it did; the pin
+ * is dropped when vm_free_frame() releases the frame. */
+bool
+vm_pin_resident (struct page *page) {
+	bool resident;
+
+	lock_acquire (&frame_lock);
+	resident = page->frame != NULL;
+	if (resident)
+		page->frame->pin_cnt++;
+	lock_release (&frame_lock);
+	return resident;
+}
+
+/* If PAGE is resident and a page mapping its frame is dirty, pins
+ * the frame, clears the dirty bits and returns true, so that the
+ * caller can write the frame back without racing with new stores
+ * going unnoticed.  Returns false otherwise. */
+bool
+vm_pin_dirty (struct page *page) {
+	struct frame *frame;
+	bool dirty;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	dirty = frame != NULL && frame_is_dirty (frame);
+	if (dirty) {
+		struct list_elem *e;
+
+		frame->pin_cnt++;
+		for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+				e = list_next (e)) {
+			struct page *map = list_entry (e, struct page, frame_elem);
+
+			if (map->pml4 != NULL)
+				pml4_set_dirty (map->pml4, map->va, false);
+		}
+	}
+	lock_release (&frame_lock);
+	return dirty;
+}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+/* Drops the pin on PAGE's frame taken by vm_pin_page(),
+ * vm_pin_resident() or vm_pin_dirty(). */
+void
+vm_unpin_page (struct page *page) {
+	frame_unpin (page->frame);
+}
 
-	return swap_in (page, frame->kva);
+/* Unmaps PAGE and gives its frame, if any, back to the user pool.
+ * Page types call this from their destroy operation. */
+void
+vm_free_frame (struct page *page) {
+	frame_release (page, false);
+}
+
+/* Unmaps PAGE and detaches it from its frame, freeing the frame if
+ * no other page uses it.  If UNPIN, also drops the caller's pin, in
+ * the same step so that the frame is never seen unpinned while PAGE
+ * is half set up. */
+static void
+frame_release (struct page *page, bool unpin) {
+	struct frame *frame;
+	bool last;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame == NULL) {
+		lock_release (&frame_lock);
+		return;
+	}
+	if (unpin)
+		frame->pin_cnt--;
+	if (page->pml4 != NULL && pml4_get_page (page->pml4, page->va) != NULL)
+		pml4_clear_page (page->pml4, page->va);
+	last = frame_detach (page) == 0 && frame != &zero_frame;
+	if (last)
+		frame_table_remove (frame);
+	lock_release (&frame_lock);
+
+	/* Other pages still share the frame. */
+	if (!last)
+		return;
+	palloc_free_page (frame->kva);
+	free (frame);
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	if (!hash_init (&spt->pages, spt_hash, spt_less, NULL))
+		PANIC ("out of memory for supplemental page table");
+	spt->stack_bottom = (void *) USER_STACK;
+	list_init (&spt->mmaps);
+	spt_account (spt, 0, 0);
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+
+	dst->stack_bottom = src->stack_bottom;
+	if (!mmap_regions_copy (&dst->mmaps, &src->mmaps))
+		return false;
+	hash_first (&i, &src->pages);
+	while (hash_next (&i)) {
+		struct page *src_page = hash_entry (hash_cur (&i), struct page,
+				spt_elem);
+		struct page *dst_page;
+
+		/* Pages never touched in the parent stay lazy in the child. */
+		if (VM_TYPE (src_page->operations->type) == VM_UNINIT) {
+			struct uninit_page *uninit = &src_page->uninit;
+
+			struct file_segment *aux = NULL;
+
+			if (uninit->aux != NULL) {
+				aux = file_segment_dup (uninit->aux);
+				if (aux == NULL)
+					return false;
+			}
+			if (!vm_alloc_page_with_initializer (uninit->type, src_page->va,
+						src_page->writable, uninit->init, aux)) {
+				file_segment_free (aux);
+				return false;
+			}
+			continue;
+		}
+
+		/* Anonymous memory is shared copy-on-write, and mapped files
+		 * are shared outright. */
+		if (VM_TYPE (src_page->operations->type) == VM_ANON
+				|| VM_TYPE (src_page->operations->type) == VM_FILE) {
+			if (!vm_share_page (dst, src_page))
+				return false;
+			continue;
+		}
+
+		/* A mapping of the page cache maps the same cache page again
+		 * when the child touches it. */
+		if (VM_TYPE (src_page->operations->type) == VM_PAGE_CACHE) {
+			struct file_segment *seg =
+				file_segment_dup (&src_page->page_cache.seg);
+
+			if (seg == NULL)
+				return false;
+			if (!vm_alloc_page_with_initializer (VM_PAGE_CACHE, src_page->va,
+						src_page->writable, NULL, seg)) {
+				file_segment_free (seg);
+				return false;
+			}
+			continue;
+		}
+
+		if (!vm_alloc_page (page_get_type (src_page), src_page->va,
+					src_page->writable))
+			return false;
+		dst_page = spt_find_page (dst, src_page->va);
+		if (!vm_claim_pinned (dst_page))
+			return false;
+		if (!vm_pin_page (src_page)) {
+			frame_unpin (dst_page->frame);
+			return false;
+		}
+		memcpy (dst_page->frame->kva, src_page->frame->kva, PGSIZE);
+		frame_unpin (src_page->frame);
+		frame_unpin (dst_page->frame);
+	}
+	return true;
 }
 
-/* Free the resource hold by the supplemental page table */
+/* Adds to DST, the SPT of the running process, a copy of SRC, an
+ * anonymous or file-backed page, that shares SRC's frame if it is
+ * resident.  An anonymous page is shared copy-on-write: both pages
+ * map the frame read-only until one of them writes, or share SRC's
+ * swap slot.  A page of a file mapping is shared as it is, like the
+ * file: both write to the one frame, which is written back when it
+ * is evicted or the last of them goes away.  Costs no page copy or
+ * file I/O. */
+static bool
+vm_share_page (struct supplemental_page_table *dst, struct page *src) {
+	bool cow = VM_TYPE (src->operations->type) == VM_ANON;
+	struct page *page = malloc (sizeof *page);
+	struct frame *frame;
+
+	if (page == NULL)
+		return false;
+	page->va = src->va;
+	page->frame = NULL;
+	page->pml4 = thread_current ()->pml4;
+	page->owner = thread_current ();
+	page->writable = src->writable;
+	if (!cow)
+		file_share (page, src);
+
+	/* Under FRAME_LOCK, so that SRC cannot be evicted to a new swap
+	 * slot between taking its slot and looking at its frame. */
+	lock_acquire (&frame_lock);
+	if (cow)
+		anon_share (page, src);
+	if (!spt_insert_page (dst, page)) {
+		lock_release (&frame_lock);
+		vm_dealloc_page (page);
+		return false;
+	}
+	frame = src->frame;
+	if (frame != NULL) {
+		/* SRC is write-protected below, which must not fail halfway
+		 * for want of memory to split a huge page. */
+		if ((cow && !pml4_split_huge_page (src->pml4, src->va))
+				|| !pml4_set_page (page->pml4, page->va, frame->kva,
+					page->writable && !cow)) {
+			lock_release (&frame_lock);
+			return false;
+		}
+		if (cow) {
+			/* The dirty bit says whether the frame still matches the
+			 * swap slot, so the child needs the parent's. */
+			if (pml4_is_dirty (src->pml4, src->va))
+				pml4_set_dirty (page->pml4, page->va, true);
+			pml4_set_writable (src->pml4, src->va, false);
+			cow_share_cnt++;
+		}
+		frame_attach (frame, page);
+	}
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Hash destructor for supplemental_page_table_kill(). */
+static void
+spt_destroy_page (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
+}
+
+/* Free the resource hold by the supplemental page table
+ * The pages are unmapped under one TLB gather, which flushes the
+ * address space once at the end. */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	struct tlb_gather tlb;
+	size_t pages;
+
+	/* A thread that never ran a user process has an empty,
+	 * zero-initialized table with no buckets. */
+	if (spt->pages.buckets == NULL)
+		return;
+
+	tlb_gather_begin (&tlb);
+	while (!list_empty (&spt->mmaps))
+		mmap_region_free (spt, list_entry (list_pop_front (&spt->mmaps),
+					struct mmap_region, elem));
+
+	pages = hash_size (&spt->pages);
+	__atomic_sub_fetch (&spt_page_cnt, pages, __ATOMIC_RELAXED);
+	__atomic_sub_fetch (&spt_bucket_cnt, spt->pages.bucket_cnt,
+			__ATOMIC_RELAXED);
+	hash_destroy (&spt->pages, spt_destroy_page);
+	spt->pages.buckets = NULL;
+	tlb_gather_end (&tlb);
 }